@@ -0,0 +1,315 @@
+#ifndef SPLOOSHKABOOM_BENCH_H
+#define SPLOOSHKABOOM_BENCH_H
+
+/*
+ * Minimal microbenchmark harness for the hot kernels of the splooshkaboom
+ * programs. A program built with -DSPLOOSHKABOOM_BENCH swaps its main() for
+ * bench::main(), which runs every benchmark registered with BENCHMARK().
+ *
+ * A benchmark gets a bench::state, does its setup and then loops on
+ * keep_running(). Only the loop is timed. The harness doubles the iteration
+ * count until a run takes at least --min-time seconds, and reports ns per
+ * iteration plus the rate of whatever the benchmark counts per iteration
+ * (layouts, candidate*layouts, games, ...).
+ *
+ * Options:
+ *   --filter <text>     only run benchmarks whose name contains text
+ *   --min-time <s>      minimum timed duration per benchmark (default 0.2)
+ *   --seed <n>          seed handed to the benchmarks (default 1)
+ *   --json <file>       also write the results as JSON
+ *   --compare <file>    compare against results from an earlier --json run
+ *   --threshold <pct>   slowdown reported as a regression (default 10)
+ *
+ * With --compare the exit status is 1 if any benchmark regressed.
+ */
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+	class state
+	{
+		uint64_t iterations;
+		uint64_t done = 0;
+		uint32_t seed_value;
+
+		double items = 0.0;
+		const char *unit = nullptr;
+
+		std::chrono::steady_clock::time_point start;
+		double seconds = 0.0;
+
+	public:
+
+		state(uint64_t n, uint32_t seed)
+			: iterations(n), seed_value(seed)
+		{
+		}
+
+		/* Loop condition of the timed part of a benchmark */
+		bool keep_running()
+		{
+			if (done == 0)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+
+			if (done++ < iterations)
+			{
+				return true;
+			}
+
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return false;
+		}
+
+		/* Fixed seed for the benchmark's random inputs */
+		uint32_t seed() const
+		{
+			return seed_value;
+		}
+
+		/* Count items (e.g. "layouts") processed per iteration */
+		void set_items_per_iteration(double n, const char *name)
+		{
+			items = n;
+			unit = name;
+		}
+
+		uint64_t iteration_count() const
+		{
+			return iterations;
+		}
+
+		double elapsed() const
+		{
+			return seconds;
+		}
+
+		double items_per_iteration() const
+		{
+			return items;
+		}
+
+		const char *items_unit() const
+		{
+			return unit;
+		}
+	};
+
+	/* Keep the compiler from optimizing away a result */
+	template<typename T>
+	inline void do_not_optimize(const T &value)
+	{
+		asm volatile("" : : "r,m"(value) : "memory");
+	}
+
+	typedef void (*function)(state &);
+
+	struct entry
+	{
+		const char *name;
+		function fn;
+	};
+
+	inline std::vector<entry> &registry()
+	{
+		static std::vector<entry> benchmarks;
+		return benchmarks;
+	}
+
+	struct registration
+	{
+		registration(const char *name, function fn)
+		{
+			/* BENCHMARK(bench_foo) is reported as foo */
+			if (std::strncmp(name, "bench_", 6) == 0)
+			{
+				name += 6;
+			}
+
+			registry().push_back({name, fn});
+		}
+	};
+
+	struct result
+	{
+		std::string name;
+		uint64_t iterations = 0;
+		double ns_per_op = 0.0;
+		double items_per_second = 0.0;
+		std::string unit;
+	};
+
+	inline result run(const entry &benchmark, double min_time, uint32_t seed)
+	{
+		for (uint64_t n = 1; ; n *= 2)
+		{
+			state s(n, seed);
+			benchmark.fn(s);
+
+			if (s.elapsed() >= min_time || n >= (1ull << 40))
+			{
+				result r;
+				r.name = benchmark.name;
+				r.iterations = n;
+				r.ns_per_op = 1e9 * s.elapsed() / n;
+				if (s.items_unit())
+				{
+					r.items_per_second = s.items_per_iteration() * n / s.elapsed();
+					r.unit = s.items_unit();
+				}
+				return r;
+			}
+		}
+	}
+
+	inline bool write_json(const char *path, const std::vector<result> &results)
+	{
+		FILE *file = std::fopen(path, "w");
+		if (!file)
+		{
+			return false;
+		}
+
+		std::fprintf(file, "[\n");
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const result &r = results[i];
+			std::fprintf(file, "{\"name\":\"%s\",\"iterations\":%" PRIu64 ",\"ns_per_op\":%.3f,\"items_per_second\":%.1f,\"unit\":\"%s\"}%s\n",
+						 r.name.c_str(), r.iterations, r.ns_per_op, r.items_per_second, r.unit.c_str(),
+						 i + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(file, "]\n");
+
+		return std::fclose(file) == 0;
+	}
+
+	/* ns_per_op by name from a file written by write_json */
+	inline std::map<std::string, double> read_json(const char *path)
+	{
+		std::map<std::string, double> times;
+
+		FILE *file = std::fopen(path, "r");
+		if (!file)
+		{
+			return times;
+		}
+
+		char line[1024];
+		while (std::fgets(line, sizeof(line), file))
+		{
+			char name[512];
+			uint64_t iterations;
+			double ns_per_op;
+
+			if (std::sscanf(line, "{\"name\":\"%511[^\"]\",\"iterations\":%" SCNu64 ",\"ns_per_op\":%lf", name, &iterations, &ns_per_op) == 3)
+			{
+				times[name] = ns_per_op;
+			}
+		}
+
+		std::fclose(file);
+		return times;
+	}
+
+	inline int main(int argc, char **argv)
+	{
+		const char *filter = "";
+		double min_time = 0.2;
+		uint32_t seed = 1;
+		const char *json_path = nullptr;
+		const char *compare_path = nullptr;
+		double threshold = 10.0;
+
+		for (int i = 1; i + 1 < argc; i += 2)
+		{
+			if (std::strcmp(argv[i], "--filter") == 0)
+			{
+				filter = argv[i+1];
+			}
+			else if (std::strcmp(argv[i], "--min-time") == 0)
+			{
+				min_time = std::strtod(argv[i+1], nullptr);
+			}
+			else if (std::strcmp(argv[i], "--seed") == 0)
+			{
+				seed = static_cast<uint32_t>(std::strtoul(argv[i+1], nullptr, 10));
+			}
+			else if (std::strcmp(argv[i], "--json") == 0)
+			{
+				json_path = argv[i+1];
+			}
+			else if (std::strcmp(argv[i], "--compare") == 0)
+			{
+				compare_path = argv[i+1];
+			}
+			else if (std::strcmp(argv[i], "--threshold") == 0)
+			{
+				threshold = std::strtod(argv[i+1], nullptr);
+			}
+		}
+
+		std::map<std::string, double> baseline;
+		if (compare_path)
+		{
+			baseline = read_json(compare_path);
+		}
+
+		std::printf("%-40s %14s %12s %20s\n", "Benchmark", "ns/op", "Iterations", "Rate");
+
+		std::vector<result> results;
+		bool regressed = false;
+
+		for (const entry &benchmark : registry())
+		{
+			if (!std::strstr(benchmark.name, filter))
+			{
+				continue;
+			}
+
+			result r = run(benchmark, min_time, seed);
+			results.push_back(r);
+
+			std::printf("%-40s %14.2f %12" PRIu64, r.name.c_str(), r.ns_per_op, r.iterations);
+			if (!r.unit.empty())
+			{
+				std::printf(" %12.4g %s/s", r.items_per_second, r.unit.c_str());
+			}
+
+			auto old = baseline.find(r.name);
+			if (old != baseline.end())
+			{
+				double change = 100.0 * (r.ns_per_op / old->second - 1.0);
+				bool slower = change > threshold;
+				regressed |= slower;
+
+				std::printf("  %+.1f%%%s", change, slower ? " REGRESSION" : "");
+			}
+
+			std::printf("\n");
+			std::fflush(stdout);
+		}
+
+		if (json_path && !write_json(json_path, results))
+		{
+			std::printf("Failed to write %s\n", json_path);
+			return 1;
+		}
+
+		return regressed ? 1 : 0;
+	}
+}
+
+#define BENCHMARK(fn) static bench::registration bench_registration_##fn(#fn, fn)
+
+#endif
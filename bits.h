@@ -0,0 +1,247 @@
+#ifndef SPLOOSHKABOOM_BITS_H
+#define SPLOOSHKABOOM_BITS_H
+
+/*
+ * Bit selection for all splooshkaboom binaries, dispatched on the CPU at run
+ * time so the binaries can be built for the baseline x86-64 ISA.
+ *
+ * select_bit(n, mask) returns the n-th lowest set bit of mask, which is what
+ * _pdep_u64(1 << n, mask) computes. PDEP is a single fast instruction on
+ * Intel since Haswell and AMD since Zen 3, but microcoded and very slow on
+ * older AMD CPUs, and missing before that. There are three implementations:
+ *
+ *   pdep       the BMI2 instruction
+ *   broadword  running byte counts, summed in one multiply, locate the byte
+ *              and then the bit within it, without branches (after Vigna,
+ *              "Broadword Implementation of Rank/Select Queries", 2008)
+ *   table      byte by byte with popcount and select-in-byte tables
+ *
+ * PDEP is used where it is fast, broadword everywhere else. Setting
+ * SPLOOSHKABOOM_SELECT=pdep|broadword|table overrides the choice.
+ * extract(value, mask) (PEXT) follows the same choice between the
+ * instruction and a loop.
+ *
+ * has_popcnt tells whether kernels that are mostly popcounts may use their
+ * target("popcnt") copies; the baseline ISA counts bits in software.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <cpuid.h>
+
+extern "C"
+{
+#include <x86intrin.h>
+}
+
+namespace bits
+{
+	enum class select_method
+	{
+		pdep,
+		broadword,
+		table,
+	};
+
+	__attribute__((target("bmi2"))) inline uint64_t select_pdep(uint32_t n, uint64_t mask)
+	{
+		return _pdep_u64(1ull << n, mask);
+	}
+
+	/* Number of bytes of sums that are at most n, for sums below 128 that
+	 * never decrease from byte to byte */
+	inline uint32_t bytes_not_above(uint64_t sums, uint32_t n)
+	{
+		const uint64_t L8 = 0x0101010101010101ull;
+		const uint64_t H8 = 0x8080808080808080ull;
+
+		/* (0x80 | n) - sum keeps its high bit exactly when sum <= n, and
+		 * never borrows from the next byte */
+		uint64_t not_above = (((n * L8) | H8) - sums) & H8;
+		return static_cast<uint32_t>(((not_above >> 7) * L8) >> 56);
+	}
+
+	inline uint64_t select_broadword(uint32_t n, uint64_t mask)
+	{
+		const uint64_t L8 = 0x0101010101010101ull;
+		const uint64_t H8 = 0x8080808080808080ull;
+
+		/* Set bits per byte, then the running total up to each byte */
+		uint64_t counts = mask - ((mask >> 1) & 0x5555555555555555ull);
+		counts = (counts & 0x3333333333333333ull) + ((counts >> 2) & 0x3333333333333333ull);
+		counts = (counts + (counts >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		uint64_t sums = counts * L8;
+
+		/* The bit is in the first byte whose running total exceeds n */
+		uint32_t shift = 8 * bytes_not_above(sums, n);
+		n -= static_cast<uint32_t>(((sums << 8) >> shift) & 0xFF);
+
+		/* The same within the byte: spread its bits over the bytes of a
+		 * word, one bit per byte, and sum them up */
+		uint64_t spread = (((mask >> shift) & 0xFF) * L8) & 0x8040201008040201ull;
+		uint64_t ones = (((spread + 0x7F7F7F7F7F7F7F7Full) | spread) & H8) >> 7;
+
+		return 1ull << (shift + bytes_not_above(ones * L8, n));
+	}
+
+	struct byte_tables
+	{
+		uint8_t count[256];
+
+		/* select[byte][n]: position of the n-th set bit of byte */
+		uint8_t select[256][8];
+	};
+
+	constexpr byte_tables make_byte_tables()
+	{
+		byte_tables tables = {};
+		for (uint32_t byte = 0; byte < 256; ++byte)
+		{
+			uint32_t count = 0;
+			for (uint32_t bit = 0; bit < 8; ++bit)
+			{
+				if (byte & (1u << bit))
+				{
+					tables.select[byte][count++] = static_cast<uint8_t>(bit);
+				}
+			}
+			tables.count[byte] = static_cast<uint8_t>(count);
+		}
+		return tables;
+	}
+
+	constexpr byte_tables tables = make_byte_tables();
+
+	inline uint64_t select_table(uint32_t n, uint64_t mask)
+	{
+		for (uint32_t shift = 0; shift < 64; shift += 8)
+		{
+			uint32_t byte = static_cast<uint32_t>(mask >> shift) & 0xFF;
+			if (n < tables.count[byte])
+			{
+				return 1ull << (shift + tables.select[byte][n]);
+			}
+			n -= tables.count[byte];
+		}
+
+		return 0;
+	}
+
+	/* BMI2 is there and PDEP/PEXT are not microcoded (AMD before family
+	 * 19h, i.e. before Zen 3) */
+	inline bool has_fast_pdep()
+	{
+		if (!__builtin_cpu_supports("bmi2"))
+		{
+			return false;
+		}
+
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+		{
+			return false;
+		}
+
+		/* "AuthenticAMD" */
+		bool amd = ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;
+		if (!amd || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		{
+			return true;
+		}
+
+		uint32_t family = (eax >> 8) & 0xF;
+		if (family == 0xF)
+		{
+			family += (eax >> 20) & 0xFF;
+		}
+
+		return family >= 0x19;
+	}
+
+	inline select_method choose_select_method()
+	{
+		/* This runs during static initialization */
+		__builtin_cpu_init();
+
+		const char *env = std::getenv("SPLOOSHKABOOM_SELECT");
+		if (env)
+		{
+			if (std::strcmp(env, "pdep") == 0 && __builtin_cpu_supports("bmi2"))
+			{
+				return select_method::pdep;
+			}
+			if (std::strcmp(env, "broadword") == 0)
+			{
+				return select_method::broadword;
+			}
+			if (std::strcmp(env, "table") == 0)
+			{
+				return select_method::table;
+			}
+		}
+
+		return has_fast_pdep() ? select_method::pdep : select_method::broadword;
+	}
+
+	/* Chosen once at startup */
+	inline const select_method selected = choose_select_method();
+
+	/* After selected, which initializes the CPU feature checks */
+	inline const bool has_popcnt = __builtin_cpu_supports("popcnt");
+
+	inline const char *select_method_name(select_method method)
+	{
+		switch (method)
+		{
+		case select_method::pdep:
+			return "pdep";
+		case select_method::broadword:
+			return "broadword";
+		default:
+			return "table";
+		}
+	}
+
+	/* The n-th lowest set bit of mask (n < popcount(mask)) */
+	inline uint64_t select_bit(uint32_t n, uint64_t mask)
+	{
+		switch (selected)
+		{
+		case select_method::pdep:
+			return select_pdep(n, mask);
+		case select_method::table:
+			return select_table(n, mask);
+		default:
+			return select_broadword(n, mask);
+		}
+	}
+
+	__attribute__((target("bmi2"))) inline uint64_t extract_pext(uint64_t value, uint64_t mask)
+	{
+		return _pext_u64(value, mask);
+	}
+
+	/* The bits of value under mask, packed into the low bits */
+	inline uint64_t extract(uint64_t value, uint64_t mask)
+	{
+		if (selected == select_method::pdep)
+		{
+			return extract_pext(value, mask);
+		}
+
+		uint64_t result = 0;
+		for (uint64_t bit = 1; mask; bit <<= 1)
+		{
+			if (value & mask & -mask)
+			{
+				result |= bit;
+			}
+			mask &= mask - 1;
+		}
+		return result;
+	}
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef SPLOOSHKABOOM_BOARD_H
+#define SPLOOSHKABOOM_BOARD_H
+
+/*
+ * Board and fleet configurations for rule variants.
+ *
+ * board::config<WIDTH, HEIGHT, LENGTHS...> describes a WIDTH x HEIGHT board
+ * with one squid of each of the given lengths. Its mask type is the
+ * smallest bitboard holding every square: uint64_t up to 64 squares,
+ * unsigned __int128 up to 128 and a multi-word wide_mask beyond that. The
+ * programs are templated on the config, so each variant gets its own
+ * compiled kernels and the standard 8x8 board runs on plain uint64_t
+ * exactly as before.
+ *
+ * The mask helpers (popcount, select_bit, square_bit, low_bits, to_hex)
+ * have overloads for all three mask types.
+ */
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+
+#include <string>
+#include <type_traits>
+
+#include "bits.h"
+
+namespace board
+{
+	typedef unsigned __int128 u128;
+
+	/* Bitboard of more than 128 squares, word 0 holding squares 0-63 */
+	template<uint32_t WORDS>
+	struct wide_mask
+	{
+		uint64_t words[WORDS];
+
+		constexpr wide_mask()
+			: words{}
+		{
+		}
+
+		/* Zero, or the low word of a mask (for ~0 and the like) */
+		constexpr wide_mask(uint64_t low)
+			: words{low}
+		{
+		}
+
+		constexpr explicit operator bool() const
+		{
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				if (words[i])
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		constexpr wide_mask operator~ () const
+		{
+			wide_mask result;
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				result.words[i] = ~words[i];
+			}
+			return result;
+		}
+
+		constexpr wide_mask &operator&= (const wide_mask &other)
+		{
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				words[i] &= other.words[i];
+			}
+			return *this;
+		}
+
+		constexpr wide_mask &operator|= (const wide_mask &other)
+		{
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				words[i] |= other.words[i];
+			}
+			return *this;
+		}
+
+		constexpr wide_mask &operator^= (const wide_mask &other)
+		{
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				words[i] ^= other.words[i];
+			}
+			return *this;
+		}
+
+		friend constexpr wide_mask operator& (wide_mask a, const wide_mask &b)
+		{
+			return a &= b;
+		}
+
+		friend constexpr wide_mask operator| (wide_mask a, const wide_mask &b)
+		{
+			return a |= b;
+		}
+
+		friend constexpr wide_mask operator^ (wide_mask a, const wide_mask &b)
+		{
+			return a ^= b;
+		}
+
+		friend constexpr bool operator== (const wide_mask &a, const wide_mask &b)
+		{
+			for (uint32_t i = 0; i < WORDS; ++i)
+			{
+				if (a.words[i] != b.words[i])
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		friend constexpr bool operator!= (const wide_mask &a, const wide_mask &b)
+		{
+			return !(a == b);
+		}
+
+		/* Ordered like the number the words make up */
+		friend constexpr bool operator< (const wide_mask &a, const wide_mask &b)
+		{
+			for (uint32_t i = WORDS; i-- > 0; )
+			{
+				if (a.words[i] != b.words[i])
+				{
+					return a.words[i] < b.words[i];
+				}
+			}
+			return false;
+		}
+
+		friend constexpr bool operator> (const wide_mask &a, const wide_mask &b)
+		{
+			return b < a;
+		}
+	};
+
+	template<uint32_t SQUARES>
+	using mask_for = typename std::conditional<SQUARES <= 64, uint64_t,
+		typename std::conditional<SQUARES <= 128, u128, wide_mask<(SQUARES + 63) / 64> >::type>::type;
+
+	inline uint32_t popcount(uint64_t mask)
+	{
+		return __builtin_popcountll(mask);
+	}
+
+	inline uint32_t popcount(u128 mask)
+	{
+		return popcount(static_cast<uint64_t>(mask)) + popcount(static_cast<uint64_t>(mask >> 64));
+	}
+
+	template<uint32_t WORDS>
+	uint32_t popcount(const wide_mask<WORDS> &mask)
+	{
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < WORDS; ++i)
+		{
+			count += popcount(mask.words[i]);
+		}
+		return count;
+	}
+
+	/* The n-th lowest set bit of mask (n < popcount(mask)) */
+	inline uint64_t select_bit(uint32_t n, uint64_t mask)
+	{
+		return bits::select_bit(n, mask);
+	}
+
+	inline u128 select_bit(uint32_t n, u128 mask)
+	{
+		uint64_t low = static_cast<uint64_t>(mask);
+		uint32_t low_count = popcount(low);
+		if (n < low_count)
+		{
+			return bits::select_bit(n, low);
+		}
+		return static_cast<u128>(bits::select_bit(n - low_count, static_cast<uint64_t>(mask >> 64))) << 64;
+	}
+
+	template<uint32_t WORDS>
+	wide_mask<WORDS> select_bit(uint32_t n, const wide_mask<WORDS> &mask)
+	{
+		wide_mask<WORDS> result;
+		for (uint32_t i = 0; i < WORDS; ++i)
+		{
+			uint32_t count = popcount(mask.words[i]);
+			if (n < count)
+			{
+				result.words[i] = bits::select_bit(n, mask.words[i]);
+				break;
+			}
+			n -= count;
+		}
+		return result;
+	}
+
+	/* Mask of just square */
+	template<typename Mask>
+	constexpr Mask square_bit(uint32_t square)
+	{
+		if constexpr (std::is_same<Mask, uint64_t>::value || std::is_same<Mask, u128>::value)
+		{
+			return static_cast<Mask>(1) << square;
+		}
+		else
+		{
+			Mask result;
+			result.words[square / 64] = 1ull << (square % 64);
+			return result;
+		}
+	}
+
+	/* Mask of squares 0 to n-1 */
+	template<typename Mask>
+	constexpr Mask low_bits(uint32_t n)
+	{
+		Mask result = 0;
+		for (uint32_t square = 0; square < n; ++square)
+		{
+			result |= square_bit<Mask>(square);
+		}
+		return result;
+	}
+
+	inline std::string to_hex(uint64_t mask)
+	{
+		char text[17];
+		std::snprintf(text, sizeof(text), "%016" PRIx64, mask);
+		return text;
+	}
+
+	inline std::string to_hex(u128 mask)
+	{
+		return to_hex(static_cast<uint64_t>(mask >> 64)) + to_hex(static_cast<uint64_t>(mask));
+	}
+
+	template<uint32_t WORDS>
+	std::string to_hex(const wide_mask<WORDS> &mask)
+	{
+		std::string text;
+		for (uint32_t i = WORDS; i-- > 0; )
+		{
+			text += to_hex(mask.words[i]);
+		}
+		return text;
+	}
+
+	template<uint32_t WIDTH, uint32_t HEIGHT, uint32_t... LENGTHS>
+	struct config
+	{
+		static constexpr uint32_t width = WIDTH;
+		static constexpr uint32_t height = HEIGHT;
+		static constexpr uint32_t squares = WIDTH * HEIGHT;
+		static constexpr uint32_t squids = sizeof...(LENGTHS);
+		static constexpr uint32_t lengths[squids] = {LENGTHS...};
+
+		/* Squares taken by the whole fleet */
+		static constexpr uint32_t squid_squares = (0 + ... + LENGTHS);
+
+		typedef mask_for<WIDTH * HEIGHT> mask;
+
+		/* Every square of the board */
+		static constexpr mask all_squares = low_bits<mask>(WIDTH * HEIGHT);
+
+		static mask square(uint32_t x, uint32_t y)
+		{
+			assert(x < WIDTH);
+			assert(y < HEIGHT);
+
+			return square_bit<mask>(x + WIDTH * y);
+		}
+
+		/* Squares of the board not in m */
+		static mask complement(const mask &m)
+		{
+			return ~m & all_squares;
+		}
+	};
+
+	/* The Wind Waker minigame */
+	typedef config<8, 8, 2, 3, 4> standard;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef SPLOOSHKABOOM_COMBINATIONS_H
+#define SPLOOSHKABOOM_COMBINATIONS_H
+
+/*
+ * Combinations in revolving-door order (Knuth, The Art of Computer
+ * Programming 4A, 7.2.1.3, Algorithm R): every t-subset of 0..n-1, each
+ * one obtained from the one before by swapping a single element for
+ * another. The elements are kept sorted, c[1] < ... < c[t], and the low
+ * ones change far more often than the high ones, so a caller that keeps
+ * state for every suffix c[j..t] only has to redo the suffixes below the
+ * highest changed element.
+ */
+
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+namespace combinations
+{
+	/* visit(c, j) for every combination, c[1..t] holding its elements and
+	 * c[j+1..t] being the same as in the one visited before (j = t for the
+	 * first). Nothing is visited when t > n; t = 0 visits the empty set. */
+	template<typename Visit>
+	void revolving_door(uint32_t n, uint32_t t, Visit visit)
+	{
+		if (t > n)
+		{
+			return;
+		}
+
+		/* c[t+1] = n bounds the top element */
+		std::vector<uint32_t> c(t + 2);
+		for (uint32_t j = 1; j <= t; ++j)
+		{
+			c[j] = j - 1;
+		}
+		c[t + 1] = n;
+
+		visit(c.data(), t);
+		if (t == 0 || t == n)
+		{
+			return;
+		}
+
+		for (;;)
+		{
+			/* R3: the easy case, moving c[1] */
+			uint32_t j = 2;
+			bool increase;
+			if (t & 1)
+			{
+				if (c[1] + 1 < c[2])
+				{
+					c[1]++;
+					visit(c.data(), 1);
+					continue;
+				}
+				increase = false;
+			}
+			else
+			{
+				if (c[1] > 0)
+				{
+					c[1]--;
+					visit(c.data(), 1);
+					continue;
+				}
+				increase = true;
+			}
+
+			for (;;)
+			{
+				if (j > t)
+				{
+					return;
+				}
+
+				if (!increase)
+				{
+					/* R4: try to decrease c[j] */
+					if (c[j] >= j)
+					{
+						c[j] = c[j - 1];
+						c[j - 1] = j - 2;
+						visit(c.data(), j);
+						break;
+					}
+					++j;
+				}
+
+				/* R5: try to increase c[j] */
+				if (j > t)
+				{
+					return;
+				}
+				if (c[j] + 1 < c[j + 1])
+				{
+					c[j - 1] = c[j];
+					c[j]++;
+					visit(c.data(), j);
+					break;
+				}
+				++j;
+				increase = false;
+			}
+		}
+	}
+
+	/* Binomial coefficient n choose k, or UINT64_MAX if it is larger.
+	 * After step i the result is (n - k + i) choose i, which only grows,
+	 * so it can stop as soon as it passes UINT64_MAX; until then the
+	 * product fits in 128 bits. */
+	inline uint64_t choose(uint32_t n, uint32_t k)
+	{
+		if (k > n)
+		{
+			return 0;
+		}
+		k = std::min(k, n - k);
+
+		unsigned __int128 result = 1;
+		for (uint32_t i = 1; i <= k; ++i)
+		{
+			result = result * (n - k + i) / i;
+			if (result > UINT64_MAX)
+			{
+				return UINT64_MAX;
+			}
+		}
+		return static_cast<uint64_t>(result);
+	}
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef SPLOOSHKABOOM_HALL_OF_FAME_H
+#define SPLOOSHKABOOM_HALL_OF_FAME_H
+
+/*
+ * The best candidates seen by any thread, shared without a mutex.
+ *
+ * hall<Candidate> keeps the top capacity (score, candidate) pairs, best
+ * first, each candidate once. Worker threads offer() what they rate. Most
+ * offers are not good enough, and those only cost a relaxed load of the
+ * lowest kept score. The rest take turns updating the slots under a
+ * seqlock: the sequence number is odd while a writer is at work, and a
+ * reader copies the slots and tries again if the number changed meanwhile
+ * (Lamport 1977, Boehm 2012 for the C++ memory model). A reader never holds
+ * up a writer, so the coordinator can take a snapshot() at any time, and
+ * version() tells it whether anything changed since the last one.
+ *
+ * Candidates must be trivially copyable, a whole number of 64-bit words
+ * (the mask types of board.h are), and ordered by operator<. Equal scores
+ * rank the smaller candidate first, so the same offers make the same hall
+ * whatever order they come in.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "profile.h"
+
+namespace hall_of_fame
+{
+	template<typename Candidate>
+	class hall
+	{
+		static_assert(std::is_trivially_copyable<Candidate>::value, "candidates are copied word by word");
+		static_assert(sizeof(Candidate) % sizeof(uint64_t) == 0, "candidates are copied word by word");
+
+		static constexpr size_t WORDS = sizeof(Candidate) / sizeof(uint64_t);
+
+		/* Every field atomic, as readers race with the writer */
+		struct slot
+		{
+			std::atomic<double> score{0.0};
+			std::atomic<uint64_t> words[WORDS] = {};
+		};
+
+		const size_t slots_size;
+		std::unique_ptr<slot[]> slots;
+		std::atomic<size_t> used{0};
+
+		/* Odd while a writer updates the slots */
+		std::atomic<uint64_t> sequence{0};
+
+		/* Score an offer has to reach, -infinity until the hall is full */
+		std::atomic<double> lowest{-std::numeric_limits<double>::infinity()};
+
+		static bool better(double a_score, const Candidate &a, double b_score, const Candidate &b)
+		{
+			return a_score != b_score ? a_score > b_score : a < b;
+		}
+
+		Candidate load(size_t i) const
+		{
+			uint64_t words[WORDS];
+			for (size_t w = 0; w < WORDS; ++w)
+			{
+				words[w] = slots[i].words[w].load(std::memory_order_relaxed);
+			}
+
+			Candidate candidate;
+			std::memcpy(&candidate, words, sizeof(candidate));
+			return candidate;
+		}
+
+		void store(size_t i, double score, const Candidate &candidate)
+		{
+			uint64_t words[WORDS];
+			std::memcpy(words, &candidate, sizeof(candidate));
+
+			slots[i].score.store(score, std::memory_order_relaxed);
+			for (size_t w = 0; w < WORDS; ++w)
+			{
+				slots[i].words[w].store(words[w], std::memory_order_relaxed);
+			}
+		}
+
+		void lock()
+		{
+			uint64_t s = sequence.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				if (!(s & 1) && sequence.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					break;
+				}
+
+				/* Updates are short, but the writer may be switched out */
+				std::this_thread::yield();
+				s = sequence.load(std::memory_order_relaxed);
+			}
+
+			/* No slot store moves above the odd sequence number */
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		void unlock()
+		{
+			sequence.fetch_add(1, std::memory_order_release);
+		}
+
+	public:
+
+		explicit hall(size_t capacity)
+			: slots_size(capacity), slots(new slot[capacity])
+		{
+		}
+
+		hall(const hall &) = delete;
+		hall &operator= (const hall &) = delete;
+
+		size_t capacity() const
+		{
+			return slots_size;
+		}
+
+		/* The lowest score that can still get in */
+		double floor() const
+		{
+			return lowest.load(std::memory_order_relaxed);
+		}
+
+		/* Changes with every update */
+		uint64_t version() const
+		{
+			return sequence.load(std::memory_order_acquire) / 2;
+		}
+
+		/* Keep candidate if it is among the best so far. A candidate that
+		 * is already in keeps its better score. Returns whether the hall
+		 * changed. Safe to call from any number of threads. */
+		bool offer(double score, const Candidate &candidate)
+		{
+			if (score < lowest.load(std::memory_order_relaxed) || slots_size == 0)
+			{
+				return false;
+			}
+
+			lock();
+
+			const size_t n = used.load(std::memory_order_relaxed);
+
+			/* Where it goes, and where it already is */
+			size_t position = n;
+			size_t old = n;
+			for (size_t i = 0; i < n; ++i)
+			{
+				const double kept_score = slots[i].score.load(std::memory_order_relaxed);
+				const Candidate kept = load(i);
+				if (position == n && better(score, candidate, kept_score, kept))
+				{
+					position = i;
+				}
+				if (kept == candidate)
+				{
+					old = i;
+					break;
+				}
+			}
+
+			/* Already in with a better score, or not good enough */
+			if (old < position || position == slots_size)
+			{
+				unlock();
+				return false;
+			}
+
+			/* Move the ones in between down one slot, dropping the old
+			 * entry or the last one */
+			size_t last = old < n ? old : std::min(n, slots_size - 1);
+			for (size_t i = last; i > position; --i)
+			{
+				store(i, slots[i - 1].score.load(std::memory_order_relaxed), load(i - 1));
+			}
+			store(position, score, candidate);
+
+			const size_t size = old < n ? n : std::min(n + 1, slots_size);
+			used.store(size, std::memory_order_relaxed);
+			if (size == slots_size)
+			{
+				lowest.store(slots[size - 1].score.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			}
+
+			unlock();
+
+			PROFILE_COUNT("hall_of_fame_updates", 1);
+			return true;
+		}
+
+		/* A consistent copy of the hall, best first */
+		std::vector<std::pair<double, Candidate> > snapshot() const
+		{
+			std::vector<std::pair<double, Candidate> > copy;
+			copy.reserve(slots_size);
+
+			for (;;)
+			{
+				const uint64_t before = sequence.load(std::memory_order_acquire);
+				if (before & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				copy.clear();
+				const size_t n = used.load(std::memory_order_relaxed);
+				for (size_t i = 0; i < n; ++i)
+				{
+					copy.emplace_back(slots[i].score.load(std::memory_order_relaxed), load(i));
+				}
+
+				/* No slot load moves below the second look at the sequence */
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (sequence.load(std::memory_order_relaxed) == before)
+				{
+					return copy;
+				}
+			}
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SPLOOSHKABOOM_PARETO_H
+#define SPLOOSHKABOOM_PARETO_H
+
+/*
+ * Multi-objective selection after NSGA-II (Deb et al., "A Fast and Elitist
+ * Multiobjective Genetic Algorithm: NSGA-II", 2002). Points are ranked by
+ * the non-dominated front they are in and, within a front, by crowding
+ * distance, so selection keeps the best trade-offs and spreads out along
+ * the front. Every objective is maximized.
+ *
+ * The fronts are found by sorting the points lexicographically first, so a
+ * point can only be dominated by points before it, and then putting every
+ * point into the first front without a point that dominates it (Zhang et
+ * al., "An Efficient Approach to Nondominated Sorting for Evolutionary
+ * Multiobjective Optimization", 2015). That is much faster than comparing
+ * all pairs on fronts of the size of a GA population.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace pareto
+{
+	/* a is at least as good as b in every objective and better in one */
+	inline bool dominates(const std::vector<double> &a, const std::vector<double> &b)
+	{
+		bool better = false;
+		for (size_t m = 0; m < a.size(); ++m)
+		{
+			if (a[m] < b[m])
+			{
+				return false;
+			}
+			better |= a[m] > b[m];
+		}
+		return better;
+	}
+
+	/* Points of every front, the non-dominated ones first */
+	inline std::vector<std::vector<size_t> > fronts(const std::vector<std::vector<double> > &objectives)
+	{
+		std::vector<size_t> order(objectives.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&] (size_t a, size_t b) { return objectives[a] > objectives[b]; });
+
+		std::vector<std::vector<size_t> > result;
+		for (size_t p : order)
+		{
+			size_t front = 0;
+			for (; front < result.size(); ++front)
+			{
+				/* The last points added are the likeliest to dominate p */
+				const std::vector<size_t> &members = result[front];
+				bool dominated = false;
+				for (size_t i = members.size(); i-- > 0 && !dominated; )
+				{
+					dominated = dominates(objectives[members[i]], objectives[p]);
+				}
+
+				if (!dominated)
+				{
+					break;
+				}
+			}
+
+			if (front == result.size())
+			{
+				result.emplace_back();
+			}
+			result[front].push_back(p);
+		}
+
+		return result;
+	}
+
+	/* Crowding distance of every point of a front: the size of the box
+	 * between its neighbours on the front, summed over the objectives
+	 * relative to the spread of each. The extremes are infinitely far. */
+	inline void crowding(const std::vector<std::vector<double> > &objectives, const std::vector<size_t> &front, std::vector<double> &distance)
+	{
+		for (size_t p : front)
+		{
+			distance[p] = 0.0;
+		}
+		if (front.empty())
+		{
+			return;
+		}
+
+		std::vector<size_t> sorted = front;
+		for (size_t m = 0; m < objectives[front[0]].size(); ++m)
+		{
+			std::sort(sorted.begin(), sorted.end(), [&] (size_t a, size_t b) { return objectives[a][m] < objectives[b][m]; });
+
+			const double low = objectives[sorted.front()][m];
+			const double high = objectives[sorted.back()][m];
+			distance[sorted.front()] = std::numeric_limits<double>::infinity();
+			distance[sorted.back()] = std::numeric_limits<double>::infinity();
+
+			if (high <= low)
+			{
+				continue;
+			}
+
+			for (size_t i = 1; i + 1 < sorted.size(); ++i)
+			{
+				distance[sorted[i]] += (objectives[sorted[i+1]][m] - objectives[sorted[i-1]][m]) / (high - low);
+			}
+		}
+	}
+
+	/*
+	 * Selection order of the points: by front, then by crowding distance,
+	 * most isolated first. front[i] and distance[i] are set to the front
+	 * and crowding distance of point i.
+	 */
+	inline std::vector<size_t> rank(const std::vector<std::vector<double> > &objectives, std::vector<uint32_t> &front, std::vector<double> &distance)
+	{
+		front.assign(objectives.size(), 0);
+		distance.assign(objectives.size(), 0.0);
+
+		std::vector<size_t> order;
+		order.reserve(objectives.size());
+
+		auto all = fronts(objectives);
+		for (size_t f = 0; f < all.size(); ++f)
+		{
+			crowding(objectives, all[f], distance);
+
+			std::sort(all[f].begin(), all[f].end(), [&] (size_t a, size_t b) { return distance[a] > distance[b]; });
+			for (size_t p : all[f])
+			{
+				front[p] = static_cast<uint32_t>(f);
+				order.push_back(p);
+			}
+		}
+
+		return order;
+	}
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef SPLOOSHKABOOM_PROFILE_H
+#define SPLOOSHKABOOM_PROFILE_H
+
+/*
+ * Built-in profiling: scoped phase timers and event counters.
+ *
+ *   PROFILE_SCOPE("name")      time the rest of the enclosing block
+ *   PROFILE_COUNT("name", n)   add n to a counter
+ *   PROFILE_REPORT_AT_EXIT()   print the breakdown at the end of the block
+ *
+ * Both expand to nothing unless the program is built with
+ * -DSPLOOSHKABOOM_PROFILE (make profile), so they cost nothing in a normal
+ * build. Otherwise every site registers a named phase or counter the first
+ * time it runs; sites with the same name share it. Timers read the TSC,
+ * which is converted to seconds against the steady clock when reporting.
+ * Phases may nest, so their times need not add up to the run time. Timers
+ * and counters may be used from any thread; a timer around a parallel
+ * region measures its wall-clock time.
+ */
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <x86intrin.h>
+}
+
+namespace profile
+{
+	struct phase
+	{
+		const char *name;
+		std::atomic<uint64_t> calls{0};
+		std::atomic<uint64_t> cycles{0};
+	};
+
+	struct counter
+	{
+		const char *name;
+		std::atomic<uint64_t> value{0};
+	};
+
+	struct registry
+	{
+		std::mutex mutex;
+
+		/* Heap allocated, so sites can keep references to them */
+		std::vector<phase *> phases;
+		std::vector<counter *> counters;
+
+		uint64_t start_cycles = __rdtsc();
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	};
+
+	inline registry &instance()
+	{
+		static registry r;
+		return r;
+	}
+
+	template<typename T>
+	T *find_or_add(std::vector<T *> &entries, const char *name)
+	{
+		std::lock_guard<std::mutex> lock(instance().mutex);
+		for (T *entry : entries)
+		{
+			if (std::strcmp(entry->name, name) == 0)
+			{
+				return entry;
+			}
+		}
+
+		/* Lives until the end of the program */
+		T *entry = new T();
+		entry->name = name;
+		entries.push_back(entry);
+		return entry;
+	}
+
+	inline phase &get_phase(const char *name)
+	{
+		return *find_or_add(instance().phases, name);
+	}
+
+	inline counter &get_counter(const char *name)
+	{
+		return *find_or_add(instance().counters, name);
+	}
+
+	class scoped_timer
+	{
+		phase &timed;
+		uint64_t start;
+
+	public:
+
+		explicit scoped_timer(phase &p)
+			: timed(p), start(__rdtsc())
+		{
+		}
+
+		scoped_timer(const scoped_timer &) = delete;
+		scoped_timer &operator= (const scoped_timer &) = delete;
+
+		~scoped_timer()
+		{
+			timed.cycles.fetch_add(__rdtsc() - start, std::memory_order_relaxed);
+			timed.calls.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	/* One reported phase or counter */
+	struct entry
+	{
+		std::string name;
+		uint64_t calls = 0;
+		uint64_t cycles = 0;
+		double seconds = 0.0;
+	};
+
+	struct snapshot
+	{
+		double seconds = 0.0;
+		double cycles_per_second = 0.0;
+		std::vector<entry> phases;
+		std::vector<entry> counters;
+	};
+
+	/* Totals since the start of the program */
+	inline snapshot collect()
+	{
+		registry &r = instance();
+
+		snapshot s;
+		s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - r.start_time).count();
+		s.cycles_per_second = (__rdtsc() - r.start_cycles) / s.seconds;
+
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (const phase *p : r.phases)
+		{
+			entry e;
+			e.name = p->name;
+			e.calls = p->calls.load(std::memory_order_relaxed);
+			e.cycles = p->cycles.load(std::memory_order_relaxed);
+			e.seconds = e.cycles / s.cycles_per_second;
+			s.phases.push_back(e);
+		}
+		for (const counter *c : r.counters)
+		{
+			entry e;
+			e.name = c->name;
+			e.calls = c->value.load(std::memory_order_relaxed);
+			s.counters.push_back(e);
+		}
+
+		return s;
+	}
+
+	/* Per-phase breakdown as a table */
+	inline void report(FILE *file)
+	{
+		snapshot s = collect();
+
+		std::fprintf(file, "\nProfile (%.3f s, %.2f GHz TSC)\n", s.seconds, s.cycles_per_second * 1e-9);
+		std::fprintf(file, "%-28s %12s %12s %8s %14s\n", "Phase", "Calls", "Seconds", "Run %", "Mcycles/call");
+		for (const entry &e : s.phases)
+		{
+			std::fprintf(file, "%-28s %12" PRIu64 " %12.4f %7.2f%% %14.4f\n", e.name.c_str(), e.calls, e.seconds,
+						 100.0 * e.seconds / s.seconds, e.calls ? 1e-6 * e.cycles / e.calls : 0.0);
+		}
+
+		std::fprintf(file, "%-28s %12s\n", "Counter", "Value");
+		for (const entry &e : s.counters)
+		{
+			std::fprintf(file, "%-28s %12" PRIu64 "\n", e.name.c_str(), e.calls);
+		}
+	}
+
+	/* The breakdown as one JSON object, for the telemetry stream */
+	inline std::string to_json()
+	{
+		snapshot s = collect();
+
+		std::string json;
+		char buffer[256];
+
+		std::snprintf(buffer, sizeof(buffer), "{\"profile\":{\"seconds\":%.6f,\"phases\":[", s.seconds);
+		json += buffer;
+		for (size_t i = 0; i < s.phases.size(); ++i)
+		{
+			const entry &e = s.phases[i];
+			std::snprintf(buffer, sizeof(buffer), "%s{\"name\":\"%s\",\"calls\":%" PRIu64 ",\"cycles\":%" PRIu64 ",\"seconds\":%.6f}",
+						  i ? "," : "", e.name.c_str(), e.calls, e.cycles, e.seconds);
+			json += buffer;
+		}
+
+		json += "],\"counters\":{";
+		for (size_t i = 0; i < s.counters.size(); ++i)
+		{
+			const entry &e = s.counters[i];
+			std::snprintf(buffer, sizeof(buffer), "%s\"%s\":%" PRIu64, i ? "," : "", e.name.c_str(), e.calls);
+			json += buffer;
+		}
+		json += "}}}";
+
+		return json;
+	}
+
+	/* Prints the breakdown when it goes out of scope, e.g. at the end of
+	 * main() whichever way main() returns */
+	struct report_at_exit
+	{
+		~report_at_exit()
+		{
+			report(stdout);
+		}
+	};
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef SPLOOSHKABOOM_PROFILE
+#define PROFILE_ENABLED 1
+#define PROFILE_SCOPE(name) \
+	static profile::phase &PROFILE_CONCAT(profile_phase_, __LINE__) = profile::get_phase(name); \
+	profile::scoped_timer PROFILE_CONCAT(profile_timer_, __LINE__)(PROFILE_CONCAT(profile_phase_, __LINE__))
+#define PROFILE_COUNT(name, n) \
+	do \
+	{ \
+		static profile::counter &profile_counter = profile::get_counter(name); \
+		profile_counter.value.fetch_add(n, std::memory_order_relaxed); \
+	} while (0)
+#define PROFILE_REPORT_AT_EXIT() profile::report_at_exit profile_report
+#else
+#define PROFILE_ENABLED 0
+#define PROFILE_SCOPE(name) do { } while (0)
+#define PROFILE_COUNT(name, n) do { } while (0)
+#define PROFILE_REPORT_AT_EXIT() do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef SPLOOSHKABOOM_RACING_H
+#define SPLOOSHKABOOM_RACING_H
+
+/*
+ * Racing evaluation of GA candidates, after Hoeffding races (Maron & Moore
+ * 1994) and successive halving.
+ *
+ * Instead of rating every candidate on the same number of layouts, all
+ * candidates are rated on a small batch first. A candidate leaves the race
+ * as soon as its confidence interval shows that it is certainly among the
+ * candidates to keep, or certainly not. The undecided ones carry on with
+ * the next layouts and the batch size doubles every step, so most of the
+ * budget goes to the candidates close to the selection boundary. Every
+ * candidate sees the same layouts in the same order. Candidates very close
+ * to the boundary cannot be told apart in any reasonable number of tests
+ * (and it matters little which of them are kept), so a race can be capped
+ * at a total number of evaluations.
+ *
+ * The intervals are z standard errors of the sample mean wide. Hoeffding
+ * bounds hold for any distribution, but are several times wider for the
+ * hit/miss goals and hardly ever separate candidates.
+ *
+ * The undecided candidates are copied into a dense array each step and
+ * rated in tiles: a tile of candidates goes over a tile of layouts small
+ * enough to stay in L1 before moving on to the next one, so the layouts
+ * are read from memory once per candidate tile rather than once per
+ * candidate. Goals with integer results are summed in integers, which
+ * also keeps the sums out of the floating point add latency chain.
+ */
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "profile.h"
+#include "scheduler.h"
+
+namespace racing
+{
+	struct options
+	{
+		/* Layouts every candidate is rated on before the first decision */
+		uint32_t first_batch = 256;
+
+		/* Standard errors between a candidate's mean and its bounds */
+		double z = 3.0;
+
+		/* Stop racing after this many goal evaluations (0: no limit). The
+		 * candidates still undecided then are ranked by their mean. */
+		uint64_t budget = 0;
+	};
+
+	/* At most this many candidates go over a tile of LAYOUT_TILE layouts
+	 * (10 KB of layouts on the standard board) */
+	constexpr size_t CANDIDATE_TILE = 64;
+	constexpr uint32_t LAYOUT_TILE = 256;
+
+	/* Confidence bounds of one candidate's mean goal value */
+	struct bounds
+	{
+		double mean = 0.0;
+		double radius = 0.0;
+		uint32_t tests = 0;
+
+		double lower() const
+		{
+			return mean - radius;
+		}
+
+		double upper() const
+		{
+			return mean + radius;
+		}
+	};
+
+	/*
+	 * Race candidates (pairs of score and candidate) for the keep best ones
+	 * on a prefix of layouts, rating them with goal(candidate, layout). On
+	 * return the candidates certainly worth keeping come first, then the
+	 * undecided and then the dropped ones, each group sorted by mean goal
+	 * value. candidate.first holds the mean and stats[i] the bounds of
+	 * candidates[i]. Returns the number of goal evaluations.
+	 */
+	template<typename Candidate, typename Layout, typename Goal>
+	uint64_t race(std::vector<std::pair<double, Candidate> > &candidates, size_t keep, const std::vector<Layout> &layouts,
+				  Goal goal, const options &opts, std::vector<bounds> &stats)
+	{
+		enum : uint8_t { UNDECIDED, KEEP, DROP };
+
+		const size_t n = candidates.size();
+		const uint32_t n_layouts = static_cast<uint32_t>(layouts.size());
+
+		/* Exact integer sums for integer goals */
+		typedef decltype(goal(candidates[0].second, layouts[0])) value_type;
+		typedef typename std::conditional<std::is_integral<value_type>::value, uint64_t, double>::type sum_type;
+
+		std::vector<sum_type> sums(n, 0);
+		std::vector<sum_type> sum_squares(n, 0);
+		std::vector<Candidate> active_candidates;
+		std::vector<uint8_t> state(n, UNDECIDED);
+		std::vector<size_t> active(n);
+		stats.assign(n, bounds());
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			active[i] = i;
+		}
+
+		std::vector<double> lowers(n), uppers(n);
+		uint64_t evaluations = 0;
+		uint32_t tested = 0;
+		uint32_t batch_end = std::min(opts.first_batch, n_layouts);
+
+		while (!active.empty() && tested < n_layouts)
+		{
+			/* Shorten the last batch to what the budget still allows */
+			if (opts.budget != 0)
+			{
+				uint64_t left = opts.budget > evaluations ? opts.budget - evaluations : 0;
+				batch_end = static_cast<uint32_t>(std::min<uint64_t>(batch_end, tested + left / active.size()));
+
+				if (batch_end <= tested)
+				{
+					break;
+				}
+			}
+
+			{
+				PROFILE_SCOPE("race_evaluate");
+
+				active_candidates.resize(active.size());
+				for (size_t a = 0; a < active.size(); ++a)
+				{
+					active_candidates[a] = candidates[active[a]].second;
+				}
+
+				/* Smaller tiles when there are few candidates left, so every
+				 * thread still gets a handful */
+				const size_t tile = std::clamp<size_t>(active.size() / (8 * scheduler::thread_count()), 1, CANDIDATE_TILE);
+				const size_t n_tiles = (active.size() + tile - 1) / tile;
+
+				scheduler::parallel_for(0, n_tiles, 1, [&] (size_t first, size_t last)
+				{
+					for (size_t t = first; t < last; ++t)
+					{
+						const size_t tile_begin = t * tile;
+						const size_t tile_end = std::min(active.size(), tile_begin + tile);
+
+						sum_type tile_sums[CANDIDATE_TILE] = {};
+						sum_type tile_squares[CANDIDATE_TILE] = {};
+
+						for (uint32_t layout_begin = tested; layout_begin < batch_end; layout_begin += LAYOUT_TILE)
+						{
+							const uint32_t layout_end = std::min(batch_end, layout_begin + LAYOUT_TILE);
+
+							for (size_t a = tile_begin; a < tile_end; ++a)
+							{
+								const Candidate candidate = active_candidates[a];
+
+								sum_type sum = tile_sums[a - tile_begin], sum_square = tile_squares[a - tile_begin];
+								for (uint32_t l = layout_begin; l < layout_end; ++l)
+								{
+									sum_type value = goal(candidate, layouts[l]);
+									sum += value;
+									sum_square += value * value;
+								}
+								tile_sums[a - tile_begin] = sum;
+								tile_squares[a - tile_begin] = sum_square;
+							}
+						}
+
+						for (size_t a = tile_begin; a < tile_end; ++a)
+						{
+							const size_t i = active[a];
+							sums[i] += tile_sums[a - tile_begin];
+							sum_squares[i] += tile_squares[a - tile_begin];
+
+							/* Keep the variance off zero for candidates that
+							 * scored the same on every layout so far */
+							double mean = static_cast<double>(sums[i]) / batch_end;
+							double variance = std::max(static_cast<double>(sum_squares[i]) / batch_end - mean * mean, 1.0 / batch_end);
+
+							stats[i].tests = batch_end;
+							stats[i].mean = mean;
+							stats[i].radius = opts.z * std::sqrt(variance / batch_end);
+						}
+					}
+				});
+			}
+
+			evaluations += static_cast<uint64_t>(active.size()) * (batch_end - tested);
+			PROFILE_COUNT("goal_evaluations", static_cast<uint64_t>(active.size()) * (batch_end - tested));
+			tested = batch_end;
+			batch_end = std::min(2 * batch_end, n_layouts);
+
+			/* Keep a candidate once n - keep candidates are certainly worse,
+			 * drop it once keep candidates are certainly better */
+			PROFILE_SCOPE("race_decide");
+			for (size_t i = 0; i < n; ++i)
+			{
+				lowers[i] = stats[i].lower();
+				uppers[i] = stats[i].upper();
+			}
+			std::sort(lowers.begin(), lowers.end());
+			std::sort(uppers.begin(), uppers.end());
+
+			size_t still_active = 0;
+			for (size_t i : active)
+			{
+				size_t better = lowers.end() - std::upper_bound(lowers.begin(), lowers.end(), stats[i].upper());
+				size_t worse = std::lower_bound(uppers.begin(), uppers.end(), stats[i].lower()) - uppers.begin();
+
+				if (better >= keep)
+				{
+					state[i] = DROP;
+				}
+				else if (worse >= n - keep)
+				{
+					state[i] = KEEP;
+				}
+				else
+				{
+					active[still_active++] = i;
+				}
+			}
+			active.resize(still_active);
+		}
+
+		/* Order kept, undecided, dropped, each by mean */
+		PROFILE_SCOPE("race_sort");
+		std::vector<size_t> order(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			order[i] = i;
+		}
+
+		auto rank = [&] (size_t i)
+		{
+			return state[i] == KEEP ? 0 : state[i] == UNDECIDED ? 1 : 2;
+		};
+
+		std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b)
+		{
+			return rank(a) != rank(b) ? rank(a) < rank(b) : stats[a].mean > stats[b].mean;
+		});
+
+		std::vector<std::pair<double, Candidate> > sorted_candidates;
+		std::vector<bounds> sorted_stats;
+		sorted_candidates.reserve(n);
+		sorted_stats.reserve(n);
+		for (size_t i : order)
+		{
+			sorted_candidates.emplace_back(stats[i].mean, candidates[i].second);
+			sorted_stats.push_back(stats[i]);
+		}
+
+		candidates.swap(sorted_candidates);
+		stats.swap(sorted_stats);
+
+		return evaluations;
+	}
+}
+
+#endif
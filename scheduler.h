@@ -0,0 +1,667 @@
+#ifndef SPLOOSHKABOOM_SCHEDULER_H
+#define SPLOOSHKABOOM_SCHEDULER_H
+
+/*
+ * Small work-stealing scheduler shared by all splooshkaboom binaries.
+ *
+ * Every worker owns a Chase-Lev deque. fork_join() pushes one half of the
+ * work to the local deque and runs the other half inline; idle workers steal
+ * from the top of other deques, preferring victims on the same NUMA node.
+ * The thread that enters a parallel region acts as worker 0 (it is not
+ * pinned), so at most thread_count() threads are ever running.
+ *
+ * Environment:
+ *   SPLOOSHKABOOM_THREADS  number of threads (default: CPUs in affinity mask)
+ *   SPLOOSHKABOOM_PIN      set to 0 to disable pinning workers to CPUs
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+extern "C"
+{
+#include <x86intrin.h>
+}
+
+namespace scheduler
+{
+	struct task
+	{
+		void (*execute)(task *);
+		std::atomic<uint32_t> done{0};
+	};
+
+	/* Chase-Lev work-stealing deque ("Correct and Efficient Work-Stealing
+	 * for Weak Memory Models", Le et al. 2013) with a fixed capacity. The
+	 * owner pushes and pops at the bottom, thieves steal from the top. */
+	class chase_lev_deque
+	{
+		static constexpr int64_t CAPACITY = 1 << 12;
+		static constexpr int64_t MASK = CAPACITY - 1;
+
+		alignas(64) std::atomic<int64_t> top{0};
+		alignas(64) std::atomic<int64_t> bottom{0};
+		alignas(64) std::atomic<task *> buffer[CAPACITY];
+
+	public:
+
+		/* Owner only. Returns false if the deque is full */
+		bool push(task *t)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t tp = top.load(std::memory_order_acquire);
+
+			if (b - tp >= CAPACITY)
+			{
+				return false;
+			}
+
+			buffer[b & MASK].store(t, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		/* Owner only */
+		task *pop()
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t tp = top.load(std::memory_order_relaxed);
+
+			if (tp > b)
+			{
+				/* Empty */
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			task *t = buffer[b & MASK].load(std::memory_order_relaxed);
+
+			if (tp == b)
+			{
+				/* Last element - race against thieves */
+				if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				{
+					t = nullptr;
+				}
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+
+			return t;
+		}
+
+		/* Any thread */
+		task *steal()
+		{
+			int64_t tp = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+
+			if (tp >= b)
+			{
+				return nullptr;
+			}
+
+			task *t = buffer[tp & MASK].load(std::memory_order_relaxed);
+
+			if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				return nullptr;
+			}
+
+			return t;
+		}
+
+		bool maybe_empty() const
+		{
+			return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+		}
+	};
+
+	/* Parse a sysfs cpulist such as "0-3,8,10-11" */
+	inline std::vector<uint32_t> parse_cpulist(const char *text)
+	{
+		std::vector<uint32_t> cpus;
+
+		while (*text)
+		{
+			char *next;
+			unsigned long first = std::strtoul(text, &next, 10);
+			if (next == text)
+			{
+				break;
+			}
+
+			unsigned long last = first;
+			if (*next == '-')
+			{
+				text = next + 1;
+				last = std::strtoul(text, &next, 10);
+			}
+
+			for (unsigned long cpu = first; cpu <= last; ++cpu)
+			{
+				cpus.push_back(static_cast<uint32_t>(cpu));
+			}
+
+			text = next;
+			while (*text == ',' || *text == '\n' || *text == ' ')
+			{
+				text++;
+			}
+		}
+
+		return cpus;
+	}
+
+	struct cpu_slot
+	{
+		uint32_t cpu;
+		uint32_t node;
+	};
+
+	/* CPUs we are allowed to run on, grouped by NUMA node */
+	inline std::vector<cpu_slot> discover_cpus()
+	{
+		std::vector<cpu_slot> slots;
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		{
+			return slots;
+		}
+
+		std::vector<bool> assigned(CPU_SETSIZE, false);
+
+		for (uint32_t node = 0; node < 1024; ++node)
+		{
+			std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+			FILE *f = std::fopen(path.c_str(), "r");
+			if (!f)
+			{
+				if (node == 0)
+				{
+					continue;
+				}
+				break;
+			}
+
+			char buffer[4096] = {0};
+			size_t n = std::fread(buffer, 1, sizeof(buffer) - 1, f);
+			std::fclose(f);
+			buffer[n] = 0;
+
+			for (uint32_t cpu : parse_cpulist(buffer))
+			{
+				if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !assigned[cpu])
+				{
+					assigned[cpu] = true;
+					slots.push_back({cpu, node});
+				}
+			}
+		}
+
+		/* No NUMA information - treat everything as node 0 */
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed) && !assigned[cpu])
+			{
+				slots.push_back({cpu, 0});
+			}
+		}
+
+		return slots;
+	}
+
+	class pool
+	{
+		struct worker
+		{
+			chase_lev_deque deque;
+			std::vector<uint32_t> victims;
+			uint32_t node = 0;
+			uint64_t seed = 0;
+			std::thread thread;
+		};
+
+		std::vector<std::unique_ptr<worker>> workers;
+		std::vector<cpu_slot> slots;
+		bool pin = false;
+
+		std::atomic<bool> stopping{false};
+		std::atomic<uint32_t> sleepers{0};
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_cv;
+
+		/* Serializes external threads entering the pool as worker 0 */
+		std::mutex external_mutex;
+
+		static int &current_index()
+		{
+			static thread_local int index = -1;
+			return index;
+		}
+
+		static pool *&current_pool()
+		{
+			static thread_local pool *p = nullptr;
+			return p;
+		}
+
+		void pin_worker(uint32_t index)
+		{
+			if (!pin || slots.empty())
+			{
+				return;
+			}
+
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(slots[index % slots.size()].cpu, &set);
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+
+		task *try_steal(worker &self)
+		{
+			/* Victims are ordered same-node first; start at a random
+			 * offset within that order to spread contention */
+			const size_t n = self.victims.size();
+			if (n == 0)
+			{
+				return nullptr;
+			}
+
+			self.seed ^= self.seed << 13;
+			self.seed ^= self.seed >> 7;
+			self.seed ^= self.seed << 17;
+
+			size_t local = 0;
+			while (local < n && workers[self.victims[local]]->node == self.node)
+			{
+				local++;
+			}
+
+			if (local > 0)
+			{
+				size_t start = self.seed % local;
+				for (size_t i = 0; i < local; ++i)
+				{
+					task *t = workers[self.victims[(start + i) % local]]->deque.steal();
+					if (t)
+					{
+						return t;
+					}
+				}
+			}
+
+			if (local < n)
+			{
+				size_t remote = n - local;
+				size_t start = self.seed % remote;
+				for (size_t i = 0; i < remote; ++i)
+				{
+					task *t = workers[self.victims[local + (start + i) % remote]]->deque.steal();
+					if (t)
+					{
+						return t;
+					}
+				}
+			}
+
+			return nullptr;
+		}
+
+		static void run_task(task *t)
+		{
+			t->execute(t);
+			t->done.store(1, std::memory_order_release);
+		}
+
+		void worker_loop(uint32_t index)
+		{
+			current_index() = static_cast<int>(index);
+			current_pool() = this;
+			pin_worker(index);
+
+			worker &self = *workers[index];
+			uint32_t idle_rounds = 0;
+
+			while (!stopping.load(std::memory_order_relaxed))
+			{
+				task *t = self.deque.pop();
+				if (!t)
+				{
+					t = try_steal(self);
+				}
+
+				if (t)
+				{
+					run_task(t);
+					idle_rounds = 0;
+					continue;
+				}
+
+				if (++idle_rounds < 256)
+				{
+					_mm_pause();
+					continue;
+				}
+
+				if (idle_rounds < 512)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				/* Nothing to do for a while - go to sleep */
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				sleepers.fetch_add(1, std::memory_order_seq_cst);
+				sleep_cv.wait_for(lock, std::chrono::milliseconds(2));
+				sleepers.fetch_sub(1, std::memory_order_relaxed);
+				idle_rounds = 0;
+			}
+
+			current_index() = -1;
+			current_pool() = nullptr;
+		}
+
+		void wake_one()
+		{
+			if (sleepers.load(std::memory_order_seq_cst) > 0)
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				sleep_cv.notify_one();
+			}
+		}
+
+		/* Run tasks until t is done */
+		void wait_for(worker &self, task &t)
+		{
+			while (t.done.load(std::memory_order_acquire) == 0)
+			{
+				task *other = self.deque.pop();
+				if (!other)
+				{
+					other = try_steal(self);
+				}
+
+				if (other)
+				{
+					run_task(other);
+				}
+				else
+				{
+					_mm_pause();
+				}
+			}
+		}
+
+	public:
+
+		explicit pool(uint32_t thread_count)
+		{
+			if (thread_count == 0)
+			{
+				thread_count = 1;
+			}
+
+			slots = discover_cpus();
+
+			const char *pin_env = std::getenv("SPLOOSHKABOOM_PIN");
+			pin = !(pin_env && std::strcmp(pin_env, "0") == 0);
+
+			/* Pinning more threads than CPUs only makes them fight */
+			if (thread_count > slots.size())
+			{
+				pin = false;
+			}
+
+			for (uint32_t i = 0; i < thread_count; ++i)
+			{
+				auto w = std::make_unique<worker>();
+				w->node = slots.empty() ? 0 : slots[i % slots.size()].node;
+				w->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+				workers.push_back(std::move(w));
+			}
+
+			for (uint32_t i = 0; i < thread_count; ++i)
+			{
+				for (uint32_t j = 0; j < thread_count; ++j)
+				{
+					if (j != i && workers[j]->node == workers[i]->node)
+					{
+						workers[i]->victims.push_back(j);
+					}
+				}
+				for (uint32_t j = 0; j < thread_count; ++j)
+				{
+					if (j != i && workers[j]->node != workers[i]->node)
+					{
+						workers[i]->victims.push_back(j);
+					}
+				}
+			}
+
+			/* Worker 0 is whichever thread enters the pool via run() */
+			for (uint32_t i = 1; i < thread_count; ++i)
+			{
+				workers[i]->thread = std::thread([this, i] { worker_loop(i); });
+			}
+		}
+
+		~pool()
+		{
+			stopping.store(true);
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				sleep_cv.notify_all();
+			}
+
+			for (auto &w : workers)
+			{
+				if (w->thread.joinable())
+				{
+					w->thread.join();
+				}
+			}
+		}
+
+		uint32_t size() const
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+		/* Run fn as worker 0. Nested calls from inside the pool run inline */
+		template<typename F>
+		void run(const F &fn)
+		{
+			if (current_pool() == this)
+			{
+				fn();
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(external_mutex);
+
+			current_index() = 0;
+			current_pool() = this;
+
+			fn();
+
+			current_index() = -1;
+			current_pool() = nullptr;
+		}
+
+		/* Run a and b, potentially in parallel. Must be called from inside run() */
+		template<typename A, typename B>
+		void fork_join(const A &a, const B &b)
+		{
+			struct closure : task
+			{
+				const B *fn;
+				static void call(task *t)
+				{
+					(*static_cast<closure *>(t)->fn)();
+				}
+			};
+
+			int index = current_index();
+			if (workers.size() == 1 || index < 0 || current_pool() != this)
+			{
+				a();
+				b();
+				return;
+			}
+
+			worker &self = *workers[index];
+
+			closure c;
+			c.execute = &closure::call;
+			c.fn = &b;
+
+			if (!self.deque.push(&c))
+			{
+				a();
+				b();
+				return;
+			}
+
+			wake_one();
+
+			a();
+
+			task *t = self.deque.pop();
+			if (t == &c)
+			{
+				b();
+				return;
+			}
+
+			/* Strict fork-join: anything above c was joined by a() */
+			if (t)
+			{
+				run_task(t);
+			}
+
+			/* c was stolen - help out until it is done */
+			wait_for(self, c);
+		}
+	};
+
+	inline uint32_t default_thread_count()
+	{
+		const char *env = std::getenv("SPLOOSHKABOOM_THREADS");
+		if (env)
+		{
+			long n = std::strtol(env, nullptr, 10);
+			if (n > 0)
+			{
+				return static_cast<uint32_t>(n);
+			}
+		}
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+		{
+			return static_cast<uint32_t>(CPU_COUNT(&allowed));
+		}
+
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	inline std::unique_ptr<pool> &global_pool()
+	{
+		static std::unique_ptr<pool> p;
+		return p;
+	}
+
+	/* (Re)create the global pool. Must not be called from inside a parallel region */
+	inline void set_thread_count(uint32_t n)
+	{
+		global_pool().reset();
+		global_pool() = std::make_unique<pool>(n);
+	}
+
+	inline pool &instance()
+	{
+		if (!global_pool())
+		{
+			set_thread_count(default_thread_count());
+		}
+		return *global_pool();
+	}
+
+	inline uint32_t thread_count()
+	{
+		return instance().size();
+	}
+
+	template<typename A, typename B>
+	void fork_join(const A &a, const B &b)
+	{
+		pool &p = instance();
+		p.run([&] { p.fork_join(a, b); });
+	}
+
+	template<typename F>
+	void parallel_for_split(pool &p, size_t begin, size_t end, size_t grain, const F &body)
+	{
+		if (end - begin <= grain)
+		{
+			body(begin, end);
+			return;
+		}
+
+		size_t mid = begin + (end - begin) / 2;
+		p.fork_join([&] { parallel_for_split(p, begin, mid, grain, body); },
+					[&] { parallel_for_split(p, mid, end, grain, body); });
+	}
+
+	/* Call body(lo, hi) over disjoint subranges covering [begin, end).
+	 * A grain of 0 picks one that gives each thread a handful of chunks. */
+	template<typename F>
+	void parallel_for(size_t begin, size_t end, size_t grain, const F &body)
+	{
+		if (end <= begin)
+		{
+			return;
+		}
+
+		pool &p = instance();
+
+		if (grain == 0)
+		{
+			grain = std::max<size_t>(1, (end - begin) / (8 * p.size()));
+		}
+
+		if (p.size() == 1 || end - begin <= grain)
+		{
+			body(begin, end);
+			return;
+		}
+
+		p.run([&] { parallel_for_split(p, begin, end, grain, body); });
+	}
+}
+
+#endif
@@ -0,0 +1,475 @@
+#ifndef SPLOOSHKABOOM_SERVER_H
+#define SPLOOSHKABOOM_SERVER_H
+
+/*
+ * Plumbing for a long-running query server on a local socket.
+ *
+ * line_server listens on a Unix domain socket or on a localhost TCP port
+ * and reads newline terminated requests from any number of clients, one
+ * thread per client. The requests of all clients go into a single queue.
+ * The caller takes them out in batches with next_batch(): everything that
+ * queued up while the previous batch was being answered, so batches grow
+ * with the load and a lone request is answered right away. Answers are
+ * lines sent back to the request's client, in the order of its requests
+ * if they are answered in batch order. At most MAX_QUEUED requests wait in
+ * the queue; a reader that finds it full stops reading until there is
+ * room, so a client that sends faster than it is answered is held back by
+ * its own socket buffers instead of growing the queue.
+ *
+ * latency_log keeps the time from receiving a request to answering it, for
+ * percentiles.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace server
+{
+	typedef std::chrono::steady_clock clock;
+
+	/* One client; closed when the last request holding it is answered */
+	class connection
+	{
+		int fd;
+		std::mutex write_mutex;
+
+	public:
+
+		explicit connection(int socket)
+			: fd(socket)
+		{
+		}
+
+		connection(const connection &) = delete;
+		connection &operator= (const connection &) = delete;
+
+		~connection()
+		{
+			::close(fd);
+		}
+
+		int socket() const
+		{
+			return fd;
+		}
+
+		/* Send line and a newline; false once the client is gone */
+		bool send(const std::string &line)
+		{
+			std::string data = line + '\n';
+
+			std::lock_guard<std::mutex> lock(write_mutex);
+			for (size_t sent = 0; sent < data.size(); )
+			{
+				ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (n <= 0)
+				{
+					return false;
+				}
+				sent += static_cast<size_t>(n);
+			}
+			return true;
+		}
+	};
+
+	/* Longer requests are cut off and flagged as too_long */
+	constexpr size_t MAX_LINE = 4096;
+
+	/* Requests of all clients waiting to be taken in a batch */
+	constexpr size_t MAX_QUEUED = 1 << 16;
+
+	struct request
+	{
+		std::shared_ptr<connection> client;
+		std::string line;
+		clock::time_point received;
+		bool too_long = false;
+	};
+
+	/* A listening socket for address: tcp:<port> for 127.0.0.1:<port>,
+	 * anything else the path of a Unix domain socket (replacing a stale
+	 * socket, but nothing else). Returns -1 and sets error on failure. */
+	inline int listen_on(const std::string &address, std::string &error)
+	{
+		int fd;
+		if (address.compare(0, 4, "tcp:") == 0)
+		{
+			sockaddr_in in = {};
+			in.sin_family = AF_INET;
+			in.sin_port = htons(static_cast<uint16_t>(std::strtoul(address.c_str() + 4, nullptr, 10)));
+			in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			fd = ::socket(AF_INET, SOCK_STREAM, 0);
+			int yes = 1;
+			if (fd >= 0)
+			{
+				::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+				::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+			}
+			if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&in), sizeof(in)) < 0)
+			{
+				error = std::strerror(errno);
+				if (fd >= 0)
+				{
+					::close(fd);
+				}
+				return -1;
+			}
+		}
+		else
+		{
+			sockaddr_un un = {};
+			un.sun_family = AF_UNIX;
+			if (address.size() >= sizeof(un.sun_path))
+			{
+				error = "socket path too long";
+				return -1;
+			}
+			std::memcpy(un.sun_path, address.c_str(), address.size());
+
+			struct stat existing;
+			if (::lstat(address.c_str(), &existing) == 0)
+			{
+				if (!S_ISSOCK(existing.st_mode))
+				{
+					error = "path exists and is not a socket";
+					return -1;
+				}
+				::unlink(address.c_str());
+			}
+
+			fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&un), sizeof(un)) < 0)
+			{
+				error = std::strerror(errno);
+				if (fd >= 0)
+				{
+					::close(fd);
+				}
+				return -1;
+			}
+		}
+
+		if (::listen(fd, 64) < 0)
+		{
+			error = std::strerror(errno);
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	class line_server
+	{
+		int listen_fd = -1;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable room;
+		std::deque<request> queue;
+		bool stopping = false;
+
+		struct reader
+		{
+			std::thread thread;
+			std::weak_ptr<connection> client;
+			std::shared_ptr<std::atomic<bool> > done;
+		};
+
+		std::thread acceptor;
+
+		/* Readers of the connected clients, and of disconnected ones that
+		 * have not been joined yet */
+		std::vector<reader> readers;
+
+		/* Queue a request, waiting for room; false once stopping */
+		bool push(std::unique_lock<std::mutex> &lock, request &&r)
+		{
+			if (queue.size() >= MAX_QUEUED)
+			{
+				wake.notify_one();
+				room.wait(lock, [this] { return stopping || queue.size() < MAX_QUEUED; });
+			}
+			if (stopping)
+			{
+				return false;
+			}
+			queue.push_back(std::move(r));
+			return true;
+		}
+
+		void read_lines(std::shared_ptr<connection> client)
+		{
+			std::string pending;
+
+			/* Dropping the rest of a line that was too long */
+			bool discarding = false;
+
+			char buffer[4096];
+			for (;;)
+			{
+				ssize_t n = ::recv(client->socket(), buffer, sizeof(buffer), 0);
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (n <= 0)
+				{
+					return;
+				}
+
+				const auto now = clock::now();
+				pending.append(buffer, static_cast<size_t>(n));
+
+				std::unique_lock<std::mutex> lock(mutex);
+				size_t begin = 0;
+				for (size_t end; (end = pending.find('\n', begin)) != std::string::npos; begin = end + 1)
+				{
+					if (discarding)
+					{
+						discarding = false;
+						continue;
+					}
+
+					size_t length = end - begin;
+					if (length > 0 && pending[end - 1] == '\r')
+					{
+						--length;
+					}
+
+					const bool queued = length > MAX_LINE
+						? push(lock, request{client, std::string(), now, true})
+						: push(lock, request{client, pending.substr(begin, length), now});
+					if (!queued)
+					{
+						return;
+					}
+				}
+				pending.erase(0, begin);
+
+				/* No newline in sight: answer now and skip to the next one */
+				if (pending.size() > MAX_LINE)
+				{
+					if (!discarding)
+					{
+						if (!push(lock, request{client, std::string(), now, true}))
+						{
+							return;
+						}
+						discarding = true;
+					}
+					pending.clear();
+				}
+				wake.notify_one();
+			}
+		}
+
+		void accept_clients()
+		{
+			for (;;)
+			{
+				int fd = ::accept(listen_fd, nullptr, nullptr);
+				if (fd < 0 && errno == EINTR)
+				{
+					continue;
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (fd < 0 || stopping)
+				{
+					if (fd >= 0)
+					{
+						::close(fd);
+					}
+					return;
+				}
+
+				/* Join the readers of clients that have left */
+				for (size_t i = 0; i < readers.size(); )
+				{
+					if (readers[i].done->load())
+					{
+						readers[i].thread.join();
+						readers[i] = std::move(readers.back());
+						readers.pop_back();
+					}
+					else
+					{
+						++i;
+					}
+				}
+
+				auto client = std::make_shared<connection>(fd);
+				auto done = std::make_shared<std::atomic<bool> >(false);
+				std::thread thread([this, client, done]
+				{
+					read_lines(client);
+					done->store(true);
+				});
+				readers.push_back(reader{std::move(thread), client, done});
+			}
+		}
+
+	public:
+
+		line_server() = default;
+		line_server(const line_server &) = delete;
+		line_server &operator= (const line_server &) = delete;
+
+		~line_server()
+		{
+			stop();
+		}
+
+		bool start(const std::string &address, std::string &error)
+		{
+			listen_fd = listen_on(address, error);
+			if (listen_fd < 0)
+			{
+				return false;
+			}
+
+			acceptor = std::thread([this] { accept_clients(); });
+			return true;
+		}
+
+		/* Wait for requests and move all queued ones (at most max) to
+		 * batch. Returns false once the server is stopped. */
+		bool next_batch(std::vector<request> &batch, size_t max)
+		{
+			batch.clear();
+
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (stopping)
+			{
+				return false;
+			}
+
+			while (!queue.empty() && batch.size() < max)
+			{
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+			room.notify_all();
+			return true;
+		}
+
+		/* Stop accepting and reading; waits for the threads */
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (listen_fd < 0)
+				{
+					return;
+				}
+				stopping = true;
+
+				/* Wakes accept() and recv() */
+				::shutdown(listen_fd, SHUT_RDWR);
+				for (const auto &r : readers)
+				{
+					if (auto client = r.client.lock())
+					{
+						::shutdown(client->socket(), SHUT_RD);
+					}
+				}
+			}
+			wake.notify_all();
+			room.notify_all();
+
+			acceptor.join();
+			for (auto &r : readers)
+			{
+				r.thread.join();
+			}
+			readers.clear();
+			queue.clear();
+
+			::close(listen_fd);
+			listen_fd = -1;
+		}
+	};
+
+	/* Request latencies, the last CAPACITY of them for percentiles */
+	class latency_log
+	{
+		static constexpr size_t CAPACITY = 1 << 16;
+
+		std::vector<double> recent;
+		size_t next = 0;
+		uint64_t total = 0;
+		double worst = 0.0;
+
+	public:
+
+		void add(double seconds)
+		{
+			if (recent.size() < CAPACITY)
+			{
+				recent.push_back(seconds);
+			}
+			else
+			{
+				recent[next] = seconds;
+				next = (next + 1) % CAPACITY;
+			}
+			total++;
+			worst = std::max(worst, seconds);
+		}
+
+		uint64_t count() const
+		{
+			return total;
+		}
+
+		/* Slowest since the start */
+		double max() const
+		{
+			return worst;
+		}
+
+		/* q-quantile (0 to 1) of the recent latencies, nearest rank */
+		double percentile(double q) const
+		{
+			if (recent.empty())
+			{
+				return 0.0;
+			}
+
+			std::vector<double> sorted = recent;
+			size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()));
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			return sorted[rank];
+		}
+	};
+}
+
+#endif
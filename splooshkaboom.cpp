@@ -1,77 +1,140 @@
+#include <cinttypes>
+#include <cmath>
 #include <cstdio>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <cassert>
 
 #include <random>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <string>
 
 extern "C"
 {
 #include <x86intrin.h>
 }
 
+#include "bits.h"
+#include "board.h"
+#include "combinations.h"
+#include "hall_of_fame.h"
+#include "pareto.h"
+#include "profile.h"
+#include "racing.h"
+#include "scheduler.h"
+#include "streams.h"
+#include "telemetry.h"
+
 using std::cout;
 using std::endl;
 
 typedef uint32_t u32;
 typedef uint64_t u64;
-typedef uint64_t square_mask;
 
+/* The standard board; every other variant is instantiated from main() */
+typedef board::standard::mask square_mask;
+
+template<typename Board>
 struct squid_layout
 {
-	square_mask combined;
-	square_mask squid2;
-	square_mask squid3;
-	square_mask squid4;
+	typename Board::mask combined;
+
+	/* One squid of each length of the fleet, in the order of Board::lengths */
+	typename Board::mask squids[Board::squids];
+
 	double probability;
 };
 
-#define WIDTH 8
-
-u32 square_offset(u32 x, u32 y)
+/* A layout as the index of each squid's placement and of its probability in
+ * a layout_table */
+template<typename Board>
+struct compact_layout
 {
-	assert(x < WIDTH);
-	assert(y < WIDTH);
+	/* Every placement list of the board fits in a byte up to 128 squares */
+	typedef typename std::conditional<2 * Board::squares <= 256, uint8_t, uint16_t>::type index;
 
-	return x + WIDTH * y;
-}
+	/* The probability depends on how many places each squid after the
+	 * first had left. With three squids there are a hundred or so
+	 * different ones on the boards up to 10x10, with more many more. */
+	typedef typename std::conditional<Board::squids <= 3, index, uint16_t>::type probability_index;
 
-void square_set(square_mask &mask, u32 x, u32 y)
-{
-	mask |= (1ull << square_offset(x,y));
-}
+	index squids[Board::squids];
+	probability_index probability;
+};
 
-bool square_get(square_mask mask, u32 x, u32 y)
+/* Layouts in compact form: 4 bytes per layout on the standard board instead
+ * of the 40 of a squid_layout. The masks are looked up when a layout is
+ * used. */
+template<typename Board>
+struct layout_table
 {
-	return (mask & (1ull << square_offset(x,y))) != 0;
-}
+	/* Every placement of each squid */
+	std::vector<typename Board::mask> placements[Board::squids];
+
+	/* The distinct layout probabilities */
+	std::vector<double> probabilities;
+
+	std::vector<compact_layout<Board> > layouts;
+
+	size_t size() const
+	{
+		return layouts.size();
+	}
+
+	bool empty() const
+	{
+		return layouts.empty();
+	}
+
+	/* Layout i with its masks */
+	squid_layout<Board> operator[] (size_t i) const
+	{
+		const compact_layout<Board> &compact = layouts[i];
+
+		squid_layout<Board> layout;
+		layout.combined = 0;
+		for (u32 level = 0; level < Board::squids; ++level)
+		{
+			layout.squids[level] = placements[level][compact.squids[level]];
+			layout.combined |= layout.squids[level];
+		}
+		layout.probability = probabilities[compact.probability];
+
+		return layout;
+	}
+};
 
-void print_square(square_mask mask)
+template<typename Board>
+void print_square(const typename Board::mask &mask)
 {
 	cout << "\n+";
-	for (u32 x = 0; x < WIDTH; ++x)
+	for (u32 x = 0; x < Board::width; ++x)
 	{
 		cout << "---+";
 	}
-	cout << endl;
+	cout << '\n';
 
-	for (u32 y = 0; y < WIDTH; ++y)
+	for (u32 y = 0; y < Board::height; ++y)
 	{
 		cout << "|";
-		for (u32 x = 0; x < WIDTH; ++x)
+		for (u32 x = 0; x < Board::width; ++x)
 		{
-			cout << (square_get(mask, x, y) ? " X |" : "   |");
+			cout << ((mask & Board::square(x, y)) ? " X |" : "   |");
 		}
-		cout << endl;
+		cout << '\n';
 
 		cout << "+";
-		for (u32 x = 0; x < WIDTH; ++x)
+		for (u32 x = 0; x < Board::width; ++x)
 		{
 			cout << "---+";
 		}
-		cout << endl;
+		cout << '\n';
 	}
 }
 
@@ -82,164 +145,509 @@ u32 randint(std::mt19937 &rng, u32 max)
 	return dist(rng);
 }
 
-square_mask insert_squid(square_mask current, u32 squid_length, std::mt19937 &rng)
+template<typename Board>
+typename Board::mask insert_squid(const typename Board::mask &current, u32 squid_length, std::mt19937 &rng)
 {
-	square_mask new_squid;
+	typename Board::mask new_squid;
 	do {
 		new_squid = 0;
 
 		if (randint(rng, 1) == 0)
 		{
 			/* horizontal */
-			u32 x = randint(rng, 8-squid_length);
-			u32 y = randint(rng, 7);
+			u32 x = randint(rng, Board::width-squid_length);
+			u32 y = randint(rng, Board::height-1);
 
 			for (u32 i = 0; i < squid_length; ++i)
 			{
-				square_set(new_squid, x+i, y);
+				new_squid |= Board::square(x+i, y);
 			}
 		}
 		else
 		{
 			/* vertical */
-			u32 x = randint(rng, 7);
-			u32 y = randint(rng, 8-squid_length);
+			u32 x = randint(rng, Board::width-1);
+			u32 y = randint(rng, Board::height-squid_length);
 
 			for (u32 i = 0; i < squid_length; ++i)
 			{
-				square_set(new_squid, x, y+i);
+				new_squid |= Board::square(x, y+i);
 			}
 		}
-	} while ((current & new_squid) != 0);
+
+		if (current & new_squid)
+		{
+			PROFILE_COUNT("insert_squid_retries", 1);
+		}
+	} while (current & new_squid);
 
 	return new_squid;
 }
 
-void generate_squids(std::mt19937 &rng, squid_layout &layout)
+template<typename Board>
+void generate_squids(std::mt19937 &rng, squid_layout<Board> &layout)
 {
-	layout.squid2 = insert_squid(0ull, 2, rng);
-	layout.combined = layout.squid2;
-
-	layout.squid3 = insert_squid(layout.combined, 3, rng);
-	layout.combined |= layout.squid3;
-
-	layout.squid4 = insert_squid(layout.combined, 4, rng);
-	layout.combined |= layout.squid4;
+	layout.combined = 0;
+	for (u32 i = 0; i < Board::squids; ++i)
+	{
+		layout.squids[i] = insert_squid<Board>(layout.combined, Board::lengths[i], rng);
+		layout.combined |= layout.squids[i];
+	}
 }
 
-square_mask nth_set(u32 n, square_mask mask)
+template<typename Mask>
+Mask nth_set(u32 n, const Mask &mask)
 {
-	assert(n < __builtin_popcountll(mask));
+	assert(n < board::popcount(mask));
 
-	return _pdep_u64(1ull << n, mask);
-
-	/* Non-BMI2 implementation in case your CPU lacks HW support: */
-
-	/* for (u32 bit = 0; bit < 64; bit++) */
-	/* { */
-	/* 	if (mask & (1ull << bit)) */
-	/* 	{ */
-	/* 		if (n == 0) */
-	/* 		{ */
-	/* 			return 1ull << bit; */
-	/* 		} */
-	/* 		n--; */
-	/* 	} */
-	/* } */
-
-	/* assert(0); */
-	/* return 0; */
+	return board::select_bit(n, mask);
 }
 
-square_mask generate_squid(u32 size, u32 x, u32 y, bool horizontal)
+template<typename Board>
+typename Board::mask generate_squid(u32 size, u32 x, u32 y, bool horizontal)
 {
-	square_mask mask = 0;
+	typename Board::mask mask = 0;
 
 	for (u32 i = 0; i < size; ++i)
 	{
 		if (horizontal)
 		{
-			square_set(mask, x+i, y);
+			mask |= Board::square(x+i, y);
 		}
 		else
 		{
-			square_set(mask, x, y+i);
+			mask |= Board::square(x, y+i);
 		}
 	}
 
 	return mask;
 }
 
-std::vector<squid_layout> generate_all_possible_squid_layouts()
+/* Every placement of a squid of the given length, horizontal and vertical
+ * ones interleaved */
+template<typename Board>
+std::vector<typename Board::mask> squid_placements(u32 size)
+{
+	std::vector<typename Board::mask> horizontal, vertical, placements;
+
+	for (u32 x = 0; x <= Board::width - size; ++x)
+	{
+		for (u32 y = 0; y < Board::height; ++y)
+		{
+			horizontal.push_back(generate_squid<Board>(size, x, y, true));
+		}
+	}
+
+	for (u32 y = 0; y <= Board::height - size; ++y)
+	{
+		for (u32 x = 0; x < Board::width; ++x)
+		{
+			vertical.push_back(generate_squid<Board>(size, x, y, false));
+		}
+	}
+
+	for (size_t i = 0; i < std::max(horizontal.size(), vertical.size()); ++i)
+	{
+		if (i < horizontal.size())
+		{
+			placements.push_back(horizontal[i]);
+		}
+		if (i < vertical.size())
+		{
+			placements.push_back(vertical[i]);
+		}
+	}
+
+	return placements;
+}
+
+/*
+ * Every layout with its probability, enumerated in two passes over the same
+ * tree of squid placements: the first counts the layouts below each choice of
+ * the first squids, the second fills exactly sized, disjoint ranges of the
+ * output with them. Both passes run in parallel over those choices.
+ *
+ * The placements a squid may still take are kept as a bitset over its
+ * placement list. Placing a squid clears the placements of the later squids
+ * that overlap it, using conflict bitsets computed up front, so the choices
+ * of the next squid and their number are a few ANDs and a popcount away.
+ * Layouts come out in the same order and with the same probabilities as
+ * drawing each squid uniformly among the places left by the ones before it,
+ * like generate_squids().
+ */
+template<typename Board>
+class layout_enumerator
 {
-	std::vector<squid_layout> layouts;
-	std::vector<square_mask> squids[5];
+	typedef typename Board::mask mask;
+	typedef typename compact_layout<Board>::index index;
+	typedef typename compact_layout<Board>::probability_index probability_index;
+
+	/* Words of a bitset over the placements of one squid */
+	static constexpr u32 WORDS = (2 * Board::squares + 63) / 64;
+
+	/* Squids placed to make up one parallel task */
+	static constexpr u32 PREFIX = Board::squids < 2 ? Board::squids : 2;
+
+	/* Free placements of every squid not placed yet */
+	struct state
+	{
+		u64 free[Board::squids][WORDS];
+	};
+
+	std::vector<mask> placements[Board::squids];
+
+	/* conflicts[a][b]: for placement p of squid a, the WORDS words at
+	 * p * WORDS are the placements of squid b overlapping it (b > a) */
+	std::vector<u64> conflicts[Board::squids][Board::squids];
+
+	state initial = {};
+
+	static u32 count_free(const u64 (&set)[WORDS])
+	{
+		u32 count = 0;
+		for (u32 w = 0; w < WORDS; ++w)
+		{
+			count += __builtin_popcountll(set[w]);
+		}
+		return count;
+	}
+
+	/* Remove what placement p of squid level takes from the later squids */
+	void place(state &s, u32 level, u32 p) const
+	{
+		for (u32 b = level + 1; b < Board::squids; ++b)
+		{
+			const u64 *conflict = &conflicts[level][b][static_cast<size_t>(p) * WORDS];
+			for (u32 w = 0; w < WORDS; ++w)
+			{
+				s.free[b][w] &= ~conflict[w];
+			}
+		}
+	}
+
+	/* Number of layouts once squids 0 to level-1 are placed */
+	u64 count(const state &s, u32 level) const
+	{
+		if (level == Board::squids)
+		{
+			return 1;
+		}
+		if (level + 1 == Board::squids)
+		{
+			return count_free(s.free[level]);
+		}
+
+		u64 total = 0;
+		for (u32 w = 0; w < WORDS; ++w)
+		{
+			for (u64 bits = s.free[level][w]; bits; bits &= bits - 1)
+			{
+				state next = s;
+				place(next, level, w * 64 + __builtin_ctzll(bits));
+				total += count(next, level + 1);
+			}
+		}
+		return total;
+	}
+
+	/* Index of probability in the probabilities of a task */
+	static u32 find_probability(std::vector<double> &probabilities, double probability)
+	{
+		for (size_t i = probabilities.size(); i-- > 0; )
+		{
+			if (probabilities[i] == probability)
+			{
+				return static_cast<u32>(i);
+			}
+		}
+
+		probabilities.push_back(probability);
+		return static_cast<u32>(probabilities.size() - 1);
+	}
+
+	/* Write the layouts once squids 0 to level-1 are placed as in layout,
+	 * with probability indices into the probabilities of the task */
+	compact_layout<Board> *fill(const state &s, u32 level, compact_layout<Board> &layout, double probability,
+								std::vector<double> &probabilities, compact_layout<Board> *out) const
+	{
+		if (level == Board::squids)
+		{
+			layout.probability = static_cast<probability_index>(find_probability(probabilities, probability));
+			*out++ = layout;
+			return out;
+		}
+
+		const double squid_prob = probability * (1.0 / count_free(s.free[level]));
+		if (level + 1 == Board::squids)
+		{
+			layout.probability = static_cast<probability_index>(find_probability(probabilities, squid_prob));
+		}
+
+		for (u32 w = 0; w < WORDS; ++w)
+		{
+			for (u64 bits = s.free[level][w]; bits; bits &= bits - 1)
+			{
+				u32 p = w * 64 + __builtin_ctzll(bits);
+				layout.squids[level] = static_cast<index>(p);
+
+				if (level + 1 == Board::squids)
+				{
+					*out++ = layout;
+				}
+				else
+				{
+					state next = s;
+					place(next, level, p);
+					out = fill(next, level + 1, layout, squid_prob, probabilities, out);
+				}
+			}
+		}
+
+		return out;
+	}
+
+	/* Place the first PREFIX squids as numbered by task, false if they
+	 * overlap */
+	bool start_task(size_t task, state &s, compact_layout<Board> &layout, double &probability) const
+	{
+		u32 choice[PREFIX];
+		for (u32 level = PREFIX; level-- > 0; )
+		{
+			choice[level] = static_cast<u32>(task % placements[level].size());
+			task /= placements[level].size();
+		}
+
+		s = initial;
+		layout = {};
+		probability = 1.0;
+
+		for (u32 level = 0; level < PREFIX; ++level)
+		{
+			u32 p = choice[level];
+			if (!((s.free[level][p / 64] >> (p % 64)) & 1))
+			{
+				return false;
+			}
+
+			probability *= 1.0 / count_free(s.free[level]);
+			layout.squids[level] = static_cast<index>(p);
+			place(s, level, p);
+		}
+
+		return true;
+	}
 
-	for (u32 size = 2; size <= 4; size++)
+	/* Layouts per task in offsets[task + 1], stopping early once there are
+	 * more than max_layouts in total. Returns the total. */
+	u64 count_tasks(std::vector<u64> &offsets, u64 max_layouts) const
 	{
-		for (u32 x = 0; x <= 8 - size; ++x)
+		offsets.assign(task_count() + 1, 0);
+
+		std::atomic<u64> total{0};
+		scheduler::parallel_for(0, task_count(), 0, [&] (size_t begin, size_t end)
 		{
-			for (u32 y = 0; y < 8; ++y)
+			for (size_t task = begin; task < end && total.load(std::memory_order_relaxed) <= max_layouts; ++task)
 			{
-				/* cout << size << " " << x << " " << y << endl; */
-				squids[size].push_back(generate_squid(size, x, y, true));
-				squids[size].push_back(generate_squid(size, y, x, false));
+				state s;
+				compact_layout<Board> layout;
+				double probability;
+				if (start_task(task, s, layout, probability))
+				{
+					offsets[task + 1] = count(s, PREFIX);
+					total.fetch_add(offsets[task + 1], std::memory_order_relaxed);
+				}
 			}
+		});
+
+		return total.load();
+	}
+
+	size_t task_count() const
+	{
+		size_t tasks = 1;
+		for (u32 level = 0; level < PREFIX; ++level)
+		{
+			tasks *= placements[level].size();
 		}
+		return tasks;
 	}
 
-	double squid2_prob = 1.0 / static_cast<double>(squids[2].size());
-	for (auto s2 : squids[2])
+public:
+
+	layout_enumerator()
 	{
-		u32 valid_s3s = 0;
-		for (auto s3 : squids[3])
+		for (u32 level = 0; level < Board::squids; ++level)
+		{
+			placements[level] = squid_placements<Board>(Board::lengths[level]);
+			assert(placements[level].size() <= WORDS * 64);
+
+			for (u32 p = 0; p < placements[level].size(); ++p)
+			{
+				initial.free[level][p / 64] |= 1ull << (p % 64);
+			}
+		}
+
+		for (u32 a = 0; a < Board::squids; ++a)
 		{
-			if ((s2 & s3) == 0)
+			for (u32 b = a + 1; b < Board::squids; ++b)
 			{
-				valid_s3s++;
+				conflicts[a][b].assign(placements[a].size() * WORDS, 0);
+				for (u32 p = 0; p < placements[a].size(); ++p)
+				{
+					for (u32 q = 0; q < placements[b].size(); ++q)
+					{
+						if (placements[a][p] & placements[b][q])
+						{
+							conflicts[a][b][static_cast<size_t>(p) * WORDS + q / 64] |= 1ull << (q % 64);
+						}
+					}
+				}
 			}
 		}
+	}
+
+	/* All layouts, or none if there are more than max_layouts */
+	layout_table<Board> enumerate(size_t max_layouts) const
+	{
+		layout_table<Board> table;
+
+		std::vector<u64> offsets;
+		if (count_tasks(offsets, max_layouts) > max_layouts)
+		{
+			return table;
+		}
+
+		size_t tasks = task_count();
+		for (size_t task = 0; task < tasks; ++task)
+		{
+			offsets[task + 1] += offsets[task];
+		}
+
+		/* Every task numbers the probabilities it comes across itself */
+		std::vector<compact_layout<Board> > layouts(offsets[tasks]);
+		std::vector<std::vector<double> > task_probabilities(tasks);
+		scheduler::parallel_for(0, tasks, 0, [&] (size_t begin, size_t end)
+		{
+			for (size_t task = begin; task < end; ++task)
+			{
+				state s;
+				compact_layout<Board> layout;
+				double probability;
+				if (start_task(task, s, layout, probability))
+				{
+					compact_layout<Board> *out = fill(s, PREFIX, layout, probability, task_probabilities[task], layouts.data() + offsets[task]);
+					assert(out == layouts.data() + offsets[task + 1]);
+					(void)out;
+				}
+			}
+		});
 
-		double squid3_prob = 1.0 / static_cast<double>(valid_s3s);
-		for (auto s3 : squids[3])
+		/* Then they are merged into one table and the indices remapped */
+		const size_t max_index = std::numeric_limits<probability_index>::max();
+		for (const auto &probabilities : task_probabilities)
 		{
-			if (s2 & s3)
+			if (probabilities.size() > max_index + 1)
 			{
-				/* Invalid layout */
-				continue;
+				return table;
 			}
+			table.probabilities.insert(table.probabilities.end(), probabilities.begin(), probabilities.end());
+		}
 
-			u32 valid_s4s = 0;
-			for (auto s4 : squids[4])
+		std::sort(table.probabilities.begin(), table.probabilities.end());
+		table.probabilities.erase(std::unique(table.probabilities.begin(), table.probabilities.end()), table.probabilities.end());
+		if (table.probabilities.size() > max_index + 1)
+		{
+			table.probabilities.clear();
+			return table;
+		}
+
+		scheduler::parallel_for(0, tasks, 0, [&] (size_t begin, size_t end)
+		{
+			for (size_t task = begin; task < end; ++task)
 			{
-				if ((s2 & s4) == 0 && (s3 & s4) == 0)
+				std::vector<probability_index> remap;
+				for (double probability : task_probabilities[task])
 				{
-					valid_s4s++;
+					remap.push_back(static_cast<probability_index>(
+						std::lower_bound(table.probabilities.begin(), table.probabilities.end(), probability) - table.probabilities.begin()));
+				}
+
+				for (u64 i = offsets[task]; i < offsets[task + 1]; ++i)
+				{
+					layouts[i].probability = remap[layouts[i].probability];
 				}
 			}
+		});
+
+		for (u32 level = 0; level < Board::squids; ++level)
+		{
+			table.placements[level] = placements[level];
+		}
+		table.layouts = std::move(layouts);
+
+		return table;
+	}
 
-			double squid4_prob = 1.0 / static_cast<double>(valid_s4s);
-			for (auto s4 : squids[4])
+	/* count random layouts, each squid drawn like in generate_squids(),
+	 * all of probability 1 / count */
+	layout_table<Board> sample(std::mt19937 &rng, size_t count) const
+	{
+		layout_table<Board> table;
+		for (u32 level = 0; level < Board::squids; ++level)
+		{
+			table.placements[level] = placements[level];
+		}
+		table.probabilities.push_back(1.0 / static_cast<double>(count));
+		table.layouts.resize(count);
+
+		for (auto &layout : table.layouts)
+		{
+			state s = initial;
+			for (u32 level = 0; level < Board::squids; ++level)
 			{
-				if ((s2 & s4) == 0 && (s3 & s4) == 0)
+				/* Uniformly among the free placements */
+				u32 n = randint(rng, count_free(s.free[level]) - 1);
+				u32 w = 0;
+				while (n >= static_cast<u32>(__builtin_popcountll(s.free[level][w])))
 				{
-					/* Valid layout - insert into vector */
-					layouts.push_back({s2|s3|s4, s2, s3, s4, squid2_prob * squid3_prob * squid4_prob});
+					n -= __builtin_popcountll(s.free[level][w]);
+					++w;
 				}
+				u32 p = w * 64 + __builtin_ctzll(bits::select_bit(n, s.free[level][w]));
+
+				layout.squids[level] = static_cast<index>(p);
+				place(s, level, p);
 			}
+			layout.probability = 0;
 		}
+
+		return table;
 	}
+};
+
+/* All layouts with their probabilities, or none if there are more than
+ * max_layouts */
+template<typename Board>
+layout_table<Board> generate_all_possible_squid_layouts(size_t max_layouts)
+{
+	layout_table<Board> layouts = layout_enumerator<Board>().enumerate(max_layouts);
 
 #if !NDEBUG
+	if (layouts.empty())
+	{
+		return layouts;
+	}
+
 	/* Verify probabilities by computing sum */
 	double sum = 0.0;
 	double min = 1.0;
 	double max = 0.0;
-	for (auto layout : layouts)
+	for (const auto &layout : layouts.layouts)
 	{
-		sum += layout.probability;
-		min = std::min(layout.probability, min);
-		max = std::max(layout.probability, max);
+		double probability = layouts.probabilities[layout.probability];
+		sum += probability;
+		min = std::min(probability, min);
+		max = std::max(probability, max);
 	}
 
 	cout << "Layout probability sum: " << sum << endl;
@@ -247,16 +655,17 @@ std::vector<squid_layout> generate_all_possible_squid_layouts()
 	cout << "Maximum layout probability: " << max << endl;
 #endif
 
-	return std::move(layouts);
+	return layouts;
 }
 
-square_mask generate_pattern(std::mt19937 &rng, u32 tries)
+template<typename Board>
+typename Board::mask generate_pattern(std::mt19937 &rng, u32 tries)
 {
-	square_mask pattern = 0ull;
+	typename Board::mask pattern = 0;
 	for (u32 i = 0; i < tries; ++i)
 	{
 		/* Find random unset bit */
-		square_mask unset_bit = nth_set(randint(rng, 63-i), ~pattern);
+		typename Board::mask unset_bit = nth_set(randint(rng, Board::squares-1-i), Board::complement(pattern));
 
 		/* Set */
 		pattern |= unset_bit;
@@ -265,19 +674,20 @@ square_mask generate_pattern(std::mt19937 &rng, u32 tries)
 	return pattern;
 }
 
-square_mask mutate_pattern(std::mt19937 &rng, square_mask original)
+template<typename Board>
+typename Board::mask mutate_pattern(std::mt19937 &rng, typename Board::mask original)
 {
-	u32 pop = __builtin_popcountll(original);
+	u32 pop = board::popcount(original);
 
 	/* Find random set bit */
-	square_mask set_bit   = nth_set(randint(rng, pop-1), original);
+	typename Board::mask set_bit   = nth_set(randint(rng, pop-1), original);
 
 	/* Find random unset bit */
-	square_mask unset_bit = nth_set(randint(rng, 63-pop), ~original);
+	typename Board::mask unset_bit = nth_set(randint(rng, Board::squares-1-pop), Board::complement(original));
 
 	assert(set_bit & original);
 	assert(unset_bit & ~original);
-	assert((set_bit & unset_bit) == 0);
+	assert(!(set_bit & unset_bit));
 
 	/* Flip those bits */
 	original ^= set_bit;
@@ -288,180 +698,1692 @@ square_mask mutate_pattern(std::mt19937 &rng, square_mask original)
 
 namespace optimization_goal
 {
+	/* Number of squids the candidate hits */
+	template<typename Board>
+	u32 squids_hit(const typename Board::mask &candidate, const squid_layout<Board> &layout)
+	{
+		u32 hit_count = 0;
+
+		for (u32 i = 0; i < Board::squids; ++i)
+		{
+			hit_count += (candidate & layout.squids[i]) ? 1 : 0;
+		}
+
+		return hit_count;
+	}
+
+	/* Index of the first squid of the given length */
+	template<typename Board>
+	constexpr u32 squid_index(u32 length)
+	{
+		u32 i = 0;
+		while (i < Board::squids && Board::lengths[i] != length)
+		{
+			++i;
+		}
+		return i;
+	}
+
 	/* Hit at least 1 squid */
-	u32 at_least_1(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 at_least_1(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
 		return (layout.combined & candidate) ? 1 : 0;
 	}
 
 	/* Hit at least 2 unique squids */
-	u32 at_least_2(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 at_least_2(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		u32 hit_count = 0;
-
-		hit_count += (candidate & layout.squid2) ? 1 : 0;
-		hit_count += (candidate & layout.squid3) ? 1 : 0;
-		hit_count += (candidate & layout.squid4) ? 1 : 0;
-
-		return (hit_count >= 2) ? 1 : 0;
+		return (squids_hit(candidate, layout) >= 2) ? 1 : 0;
 	}
 
-	/* Hit all 3 squids */
-	u32 at_least_3(const square_mask &candidate, const squid_layout &layout)
+	/* Hit at least 3 unique squids (all 3 on the standard board) */
+	template<typename Board>
+	u32 at_least_3(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		u32 hit_count = 0;
+		return (squids_hit(candidate, layout) >= 3) ? 1 : 0;
+	}
 
-		hit_count += (candidate & layout.squid2) ? 1 : 0;
-		hit_count += (candidate & layout.squid3) ? 1 : 0;
-		hit_count += (candidate & layout.squid4) ? 1 : 0;
+	/* Hit the (first) squid of length LENGTH */
+	template<typename Board, u32 LENGTH>
+	u32 find_squid(const typename Board::mask &candidate, const squid_layout<Board> &layout)
+	{
+		constexpr u32 index = squid_index<Board>(LENGTH);
+		static_assert(index < Board::squids, "The fleet has no squid of this length");
 
-		return (hit_count >= 3) ? 1 : 0;
+		return (layout.squids[index] & candidate) ? 1 : 0;
 	}
 
 	/* Hit the length 2 squid */
-	u32 find_squid_2(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 find_squid_2(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		return (layout.squid2 & candidate) ? 1 : 0;
+		return find_squid<Board, 2>(candidate, layout);
 	}
 
 	/* Hit the length 3 squid */
-	u32 find_squid_3(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 find_squid_3(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		return (layout.squid3 & candidate) ? 1 : 0;
+		return find_squid<Board, 3>(candidate, layout);
 	}
 
 	/* Hit the length 4 squid */
-	u32 find_squid_4(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 find_squid_4(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		return (layout.squid4 & candidate) ? 1 : 0;
+		return find_squid<Board, 4>(candidate, layout);
 	}
 
 	/* Find the pattern with the highest number of expected hits */
-	u32 max_hits(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 max_hits(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		return __builtin_popcountll(candidate & layout.combined);
+		return board::popcount(candidate & layout.combined);
 	}
 
 	/* Find nothing - anti-optimization*/
-	u32 find_0(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 find_0(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
 		return (candidate & layout.combined) ? 0 : 1;
 	}
 
 	/* Find exactly one squid */
-	u32 find_1(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 find_1(const typename Board::mask &candidate, const squid_layout<Board> &layout)
 	{
-		u32 hit_count = 0;
+		return (squids_hit(candidate, layout) == 1) ? 1 : 0;
+	}
+
+	/* Find exactly two squids */
+	template<typename Board>
+	u32 find_2(const typename Board::mask &candidate, const squid_layout<Board> &layout)
+	{
+		return (squids_hit(candidate, layout) == 2) ? 1 : 0;
+	}
+}
+
+/* Goal function of a board variant */
+template<typename Board>
+using goal_function = u32 (*)(const typename Board::mask &, const squid_layout<Board> &);
 
-		hit_count += (candidate & layout.squid2) ? 1 : 0;
-		hit_count += (candidate & layout.squid3) ? 1 : 0;
-		hit_count += (candidate & layout.squid4) ? 1 : 0;
+/* The goals as functions of which squids a pattern hit (bit i for squid i)
+ * and how many squid squares, for hit_histogram */
+namespace hit_goal
+{
+	template<typename Board>
+	u32 at_least_1(u32 squids, u32)
+	{
+		return squids ? 1 : 0;
+	}
 
-		return (hit_count == 1) ? 1 : 0;
+	template<typename Board>
+	u32 at_least_2(u32 squids, u32)
+	{
+		return (__builtin_popcount(squids) >= 2) ? 1 : 0;
 	}
 
-	/* Find exactly two squids */
-	u32 find_2(const square_mask &candidate, const squid_layout &layout)
+	template<typename Board>
+	u32 at_least_3(u32 squids, u32)
 	{
-		u32 hit_count = 0;
+		return (__builtin_popcount(squids) >= 3) ? 1 : 0;
+	}
+
+	template<typename Board, u32 LENGTH>
+	u32 find_squid(u32 squids, u32)
+	{
+		constexpr u32 index = optimization_goal::squid_index<Board>(LENGTH);
+		static_assert(index < Board::squids, "The fleet has no squid of this length");
 
-		hit_count += (candidate & layout.squid2) ? 1 : 0;
-		hit_count += (candidate & layout.squid3) ? 1 : 0;
-		hit_count += (candidate & layout.squid4) ? 1 : 0;
+		return (squids >> index) & 1;
+	}
 
-		return (hit_count == 2) ? 1 : 0;
+	template<typename Board>
+	u32 find_squid_2(u32 squids, u32 hits)
+	{
+		return find_squid<Board, 2>(squids, hits);
 	}
-}
 
-int main()
-{
-	const u32 PATTERN_SIZE = 8;
-	const u32 CANDIDATE_POPULATION = 1 << 13;
-	const u32 TESTS = 1 << 13;
-	const u32 ROUNDS = 100;
+	template<typename Board>
+	u32 find_squid_3(u32 squids, u32 hits)
+	{
+		return find_squid<Board, 3>(squids, hits);
+	}
 
-	const auto GOAL = optimization_goal::at_least_1;
+	template<typename Board>
+	u32 find_squid_4(u32 squids, u32 hits)
+	{
+		return find_squid<Board, 4>(squids, hits);
+	}
 
-	std::random_device dev;
-	std::mt19937 rng(dev());
+	template<typename Board>
+	u32 max_hits(u32, u32 hits)
+	{
+		return hits;
+	}
 
-	std::vector<std::pair<double, square_mask> > candidates;
+	template<typename Board>
+	u32 find_0(u32 squids, u32)
+	{
+		return squids ? 0 : 1;
+	}
 
-	auto all_layouts = generate_all_possible_squid_layouts();
+	template<typename Board>
+	u32 find_1(u32 squids, u32)
+	{
+		return (__builtin_popcount(squids) == 1) ? 1 : 0;
+	}
 
-	for (u32 round = 0; round < ROUNDS; ++round)
+	template<typename Board>
+	u32 find_2(u32 squids, u32)
 	{
-		cout << "Round " << round << endl;
+		return (__builtin_popcount(squids) == 2) ? 1 : 0;
+	}
+}
 
-		for (auto &candidate : candidates)
-		{
-			candidate.first = 0;
-		}
+typedef u32 (*hit_goal_function)(u32 squids, u32 hits);
 
-		while(candidates.size() < CANDIDATE_POPULATION)
-		{
-			candidates.emplace_back(0, generate_pattern(rng, PATTERN_SIZE));
-		}
+/*
+ * Joint histogram, over layouts, of which squids a candidate hits and how
+ * many squid squares. Every goal is a function of the two (see hit_goal),
+ * so one pass over the layouts that only computes the bin of each layout
+ * gives the value of all goals at once.
+ */
+template<typename Board>
+struct hit_histogram
+{
+	/* Squids hit (bit i for squid i) by squares hit */
+	static constexpr u32 SQUID_SETS = 1u << Board::squids;
+	static constexpr u32 HITS = Board::squid_squares + 1;
+	static constexpr u32 BINS = SQUID_SETS * HITS;
 
-		for (u32 test = 0; test < TESTS; ++test)
-		{
-			squid_layout layout;
-			generate_squids(rng, layout);
+	/* Layouts or probability per bin */
+	double bins[BINS] = {};
 
-			for (auto &candidate : candidates)
-			{
-				candidate.first += GOAL(candidate.second, layout);
-			}
+	static u32 bin(const typename Board::mask &candidate, const squid_layout<Board> &layout)
+	{
+		u32 squids = 0;
+		for (u32 i = 0; i < Board::squids; ++i)
+		{
+			squids |= ((candidate & layout.squids[i]) ? 1u : 0u) << i;
 		}
 
-		std::sort(candidates.begin(), candidates.end(), std::greater<>());
+		return squids * HITS + board::popcount(candidate & layout.combined);
+	}
 
-		cout << "Best: " << endl;
-		print_square(candidates[0].second);
-		for (u32 i = 0; i < 10; ++i)
+	/* Histogram of the candidate over layouts, one per layout */
+	static hit_histogram count(const typename Board::mask &candidate, const std::vector<squid_layout<Board> > &layouts)
+	{
+		u32 counts[BINS] = {};
+		for (const auto &layout : layouts)
 		{
-			auto &candidate = candidates[i];
-			u64 hits = candidate.first;
-			cout << 100.0 * static_cast<float>(hits) / static_cast<float>(TESTS) << endl;
+			counts[bin(candidate, layout)]++;
 		}
 
-		cout << "Worst: " << endl;
-		for (u32 i = 0; i < 10; ++i)
+		hit_histogram result;
+		for (u32 b = 0; b < BINS; ++b)
 		{
-			auto &candidate = candidates[candidates.size() - i - 1];
-			u64 hits = candidate.first;
-			cout << 100.0 * static_cast<float>(hits) / static_cast<float>(TESTS) << endl;
+			result.bins[b] = counts[b];
 		}
+		return result;
+	}
 
-		candidates.resize(candidates.size() / 2);
+	/* Sum of the goal over the layouts */
+	double total(hit_goal_function goal) const
+	{
+		double sum = 0.0;
+		for (u32 squids = 0; squids < SQUID_SETS; ++squids)
+		{
+			for (u32 hits = 0; hits < HITS; ++hits)
+			{
+				sum += bins[squids * HITS + hits] * goal(squids, hits);
+			}
+		}
+		return sum;
+	}
+};
+
+/* Goals by name, for --goal */
+template<typename Board>
+struct named_goal
+{
+	const char *name;
+	goal_function<Board> goal;
+	hit_goal_function of_hits;
+};
+
+template<typename Board>
+const std::vector<named_goal<Board> > &all_goals()
+{
+	static const std::vector<named_goal<Board> > goals =
+	{
+		{"at_least_1", optimization_goal::at_least_1<Board>, hit_goal::at_least_1<Board>},
+		{"at_least_2", optimization_goal::at_least_2<Board>, hit_goal::at_least_2<Board>},
+		{"at_least_3", optimization_goal::at_least_3<Board>, hit_goal::at_least_3<Board>},
+		{"find_squid_2", optimization_goal::find_squid_2<Board>, hit_goal::find_squid_2<Board>},
+		{"find_squid_3", optimization_goal::find_squid_3<Board>, hit_goal::find_squid_3<Board>},
+		{"find_squid_4", optimization_goal::find_squid_4<Board>, hit_goal::find_squid_4<Board>},
+		{"max_hits", optimization_goal::max_hits<Board>, hit_goal::max_hits<Board>},
+		{"find_0", optimization_goal::find_0<Board>, hit_goal::find_0<Board>},
+		{"find_1", optimization_goal::find_1<Board>, hit_goal::find_1<Board>},
+		{"find_2", optimization_goal::find_2<Board>, hit_goal::find_2<Board>},
+	};
+	return goals;
+}
+
+/* The goal called name, or nullptr */
+template<typename Board>
+const named_goal<Board> *find_goal(const std::string &name)
+{
+	for (const auto &goal : all_goals<Board>())
+	{
+		if (name == goal.name)
+		{
+			return &goal;
+		}
+	}
+	return nullptr;
+}
+
+/* Walk the layouts of a table in runs that share the probability and all
+ * squids but the last, so only the last squid's mask changes from layout to
+ * layout: visit(layout) for each layout, then end_run(probability) */
+template<typename Board, typename Visit, typename EndRun>
+void for_each_layout_run(const layout_table<Board> &all_layouts, Visit visit, EndRun end_run)
+{
+	const u32 last = Board::squids - 1;
+
+	size_t i = 0;
+	while (i < all_layouts.size())
+	{
+		const compact_layout<Board> &first = all_layouts.layouts[i];
+
+		squid_layout<Board> layout = all_layouts[i];
+		typename Board::mask others = layout.combined ^ layout.squids[last];
+
+		for (; i < all_layouts.size(); ++i)
+		{
+			const compact_layout<Board> &compact = all_layouts.layouts[i];
+
+			bool same = compact.probability == first.probability;
+			for (u32 level = 0; level < last; ++level)
+			{
+				same &= compact.squids[level] == first.squids[level];
+			}
+			if (!same)
+			{
+				break;
+			}
+
+			layout.squids[last] = all_layouts.placements[last][compact.squids[last]];
+			layout.combined = others | layout.squids[last];
+			visit(layout);
+		}
+
+		end_run(first.probability);
+	}
+}
+
+/* Probability that candidate reaches the goal, over every possible layout */
+template<typename Board>
+double exact_rating(const typename Board::mask &candidate, const layout_table<Board> &all_layouts, goal_function<Board> goal)
+{
+	PROFILE_SCOPE("exact_rating");
+
+	/* Goal values summed per probability, weighted at the end */
+	std::vector<u64> totals(all_layouts.probabilities.size(), 0);
+	u64 total = 0;
+	for_each_layout_run(all_layouts,
+		[&] (const squid_layout<Board> &layout)
+		{
+			total += goal(candidate, layout);
+		},
+		[&] (size_t probability)
+		{
+			totals[probability] += total;
+			total = 0;
+		});
+
+	double rating = 0.0;
+	for (size_t p = 0; p < totals.size(); ++p)
+	{
+		rating += totals[p] * all_layouts.probabilities[p];
+	}
+	return rating;
+}
+
+/* Probability of every bin of the candidate's hit_histogram, over every
+ * possible layout */
+template<typename Board>
+hit_histogram<Board> exact_histogram(const typename Board::mask &candidate, const layout_table<Board> &all_layouts)
+{
+	PROFILE_SCOPE("exact_histogram");
+
+	typedef hit_histogram<Board> histogram;
+
+	/* Layouts per probability and bin. A run of layouts only touches a
+	 * few bins, so it is counted apart and those are added. */
+	const size_t n_probabilities = all_layouts.probabilities.size();
+	std::vector<u64> counts(n_probabilities * histogram::BINS, 0);
+	u32 run_counts[histogram::BINS] = {};
+	u32 touched[histogram::BINS];
+	u32 n_touched = 0;
+
+	for_each_layout_run(all_layouts,
+		[&] (const squid_layout<Board> &layout)
+		{
+			u32 bin = histogram::bin(candidate, layout);
+			if (run_counts[bin]++ == 0)
+			{
+				touched[n_touched++] = bin;
+			}
+		},
+		[&] (size_t probability)
+		{
+			for (u32 i = 0; i < n_touched; ++i)
+			{
+				counts[probability * histogram::BINS + touched[i]] += run_counts[touched[i]];
+				run_counts[touched[i]] = 0;
+			}
+			n_touched = 0;
+		});
+
+	histogram result;
+	for (size_t p = 0; p < n_probabilities; ++p)
+	{
+		for (u32 bin = 0; bin < histogram::BINS; ++bin)
+		{
+			result.bins[bin] += counts[p * histogram::BINS + bin] * all_layouts.probabilities[p];
+		}
+	}
+	return result;
+}
+
+/* The probability of each of the goals, from one pass over the layouts */
+template<typename Board>
+std::vector<double> exact_ratings(const typename Board::mask &candidate, const layout_table<Board> &all_layouts, const std::vector<named_goal<Board> > &goals)
+{
+	hit_histogram<Board> histogram = exact_histogram(candidate, all_layouts);
+
+	std::vector<double> ratings;
+	for (const auto &goal : goals)
+	{
+		ratings.push_back(histogram.total(goal.of_hits));
+	}
+	return ratings;
+}
+
+/*
+ * Exact search over every pattern of a few shots, as ground truth for the
+ * GA. The layouts are numbered, and every square gets a bitset of the
+ * layouts in which it holds a squid, one per group of squids the goal
+ * tells apart (a single group for at_least_1, one per squid for
+ * at_least_2). The groups a pattern hits in every layout are then the OR
+ * of its squares' bitsets. The patterns are walked in revolving-door order
+ * (see combinations.h), one square swapped per step, and the ORs of every
+ * suffix of the sorted squares are kept, so a step only redoes the few
+ * suffixes below the square that changed; the lowest square is ORed in
+ * while rating.
+ *
+ * The layouts are numbered by probability, each probability starting at a
+ * new word, so a pattern's rating is a popcount per probability and the
+ * same sum exact_rating() makes. The layout distribution is the same under
+ * mirroring (and transposing, on square boards), so only the smallest
+ * pattern under those is rated. The work is split into chunks by the two
+ * highest squares, which run in parallel and each keep their own best
+ * patterns.
+ */
+template<typename Board>
+class exhaustive_search
+{
+	typedef typename Board::mask mask;
+	typedef std::pair<double, mask> rated;
+
+	/* Squids of every group (bit i for squid i) */
+	std::vector<u32> groups;
+
+	/* Sets of groups hit (bit g for group g) that miss the goal */
+	std::vector<u32> missed_sets;
+
+	/* max_hits is a sum over the squares instead */
+	bool additive = false;
+	std::vector<double> square_values;
+
+	/* Words of the layout bitsets and where each probability's start */
+	size_t words = 0;
+	std::vector<size_t> probability_begin;
+	std::vector<double> probabilities;
+
+	/* Layouts actually in each word */
+	std::vector<u64> used;
+
+	/* covered[(square * words + w) * groups.size() + g]: layouts of word w
+	 * in which a squid of group g covers square */
+	std::vector<u64> covered;
+
+	/* Square of each square under every symmetry but the identity */
+	std::vector<std::vector<u32> > symmetries;
+
+	/* Better first; ties go to the smaller mask */
+	static bool better(const rated &a, const rated &b)
+	{
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	}
+
+	/* The groups in which a squid is hit, for a set of squids hit */
+	u32 groups_hit(u32 squids) const
+	{
+		u32 hit = 0;
+		for (u32 g = 0; g < groups.size(); ++g)
+		{
+			hit |= ((squids & groups[g]) ? 1u : 0u) << g;
+		}
+		return hit;
+	}
+
+	/* Whether the goal only depends on which of the groups are hit; if so,
+	 * keeps them */
+	bool try_groups(const named_goal<Board> &goal, const std::vector<u32> &candidate)
+	{
+		groups = candidate;
+
+		const u32 sets = 1u << groups.size();
+		std::vector<int> value(sets, -1);
+		for (u32 squids = 0; squids < (1u << Board::squids); ++squids)
+		{
+			int &known = value[groups_hit(squids)];
+			int reached = goal.of_hits(squids, 0) ? 1 : 0;
+			if (known >= 0 && known != reached)
+			{
+				return false;
+			}
+			known = reached;
+		}
+
+		missed_sets.clear();
+		for (u32 set = 0; set < sets; ++set)
+		{
+			if (value[set] == 0)
+			{
+				missed_sets.push_back(set);
+			}
+		}
+		return true;
+	}
+
+	/* Probability of reaching the goal for the pattern whose other squares
+	 * have the ORs above and whose lowest square has the bitsets square */
+	template<u32 GROUPS>
+	__attribute__((always_inline)) double rate(const u64 *above, const u64 *square) const
+	{
+		double rating = 0.0;
+		for (size_t p = 0; p < probabilities.size(); ++p)
+		{
+			u64 count = 0;
+			for (size_t w = probability_begin[p]; w < probability_begin[p + 1]; ++w)
+			{
+				u64 hit[GROUPS];
+				for (u32 g = 0; g < GROUPS; ++g)
+				{
+					hit[g] = above[w * GROUPS + g] | square[w * GROUPS + g];
+				}
+
+				u64 missed = 0;
+				for (u32 set : missed_sets)
+				{
+					u64 in_set = ~0ull;
+					for (u32 g = 0; g < GROUPS; ++g)
+					{
+						in_set &= ((set >> g) & 1) ? hit[g] : ~hit[g];
+					}
+					missed |= in_set;
+				}
+				count += board::popcount(used[w] & ~missed);
+			}
+			rating += count * probabilities[p];
+		}
+		return rating;
+	}
+
+	/* The same with the POPCNT instruction, which about halves the time */
+	template<u32 GROUPS>
+	__attribute__((target("popcnt"))) double rate_popcnt(const u64 *above, const u64 *square) const
+	{
+		return rate<GROUPS>(above, square);
+	}
+
+	template<u32 GROUPS>
+	double rate_dispatched(const u64 *above, const u64 *square) const
+	{
+		return bits::has_popcnt ? rate_popcnt<GROUPS>(above, square) : rate<GROUPS>(above, square);
+	}
+
+	/* No symmetry maps the pattern to a smaller one */
+	bool canonical(const u32 *squares, u32 n, const mask &pattern) const
+	{
+		for (const auto &symmetry : symmetries)
+		{
+			mask image = 0;
+			for (u32 i = 0; i < n; ++i)
+			{
+				image |= board::square_bit<mask>(symmetry[squares[i]]);
+			}
+			if (image < pattern)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void keep(std::vector<rated> &best, u32 top, const rated &candidate)
+	{
+		/* A heap with the worst of the kept patterns on top */
+		if (best.size() < top)
+		{
+			best.push_back(candidate);
+			std::push_heap(best.begin(), best.end(), better);
+		}
+		else if (better(candidate, best.front()))
+		{
+			std::pop_heap(best.begin(), best.end(), better);
+			best.back() = candidate;
+			std::push_heap(best.begin(), best.end(), better);
+		}
+	}
+
+public:
+
+	/* Patterns rated by the last search, up to symmetry */
+	u64 rated_patterns = 0;
+
+	exhaustive_search(const layout_table<Board> &all_layouts, const named_goal<Board> &goal)
+	{
+		PROFILE_SCOPE("exhaustive_setup");
+
+		const u32 flips = Board::width == Board::height ? 8 : 4;
+		symmetries.resize(flips - 1);
+		for (u32 y = 0; y < Board::height; ++y)
+		{
+			for (u32 x = 0; x < Board::width; ++x)
+			{
+				for (u32 s = 1; s < flips; ++s)
+				{
+					u32 sx = (s & 1) ? Board::width - 1 - x : x;
+					u32 sy = (s & 2) ? Board::height - 1 - y : y;
+					if (s & 4)
+					{
+						std::swap(sx, sy);
+					}
+					symmetries[s - 1].push_back(sx + Board::width * sy);
+				}
+			}
+		}
+
+		if (goal.of_hits == &hit_goal::max_hits<Board>)
+		{
+			additive = true;
+			for (u32 square = 0; square < Board::squares; ++square)
+			{
+				square_values.push_back(exact_rating(board::square_bit<mask>(square), all_layouts, goal.goal));
+			}
+			return;
+		}
+
+		/* The fewest groups the goal tells apart: all squids as one, a
+		 * single squid, or every squid on its own. Every goal but
+		 * max_hits only depends on the squids hit. */
+		const u32 all = (1u << Board::squids) - 1;
+		bool found = try_groups(goal, {all});
+		for (u32 i = 0; i < Board::squids && !found; ++i)
+		{
+			found = try_groups(goal, {1u << i});
+		}
+		if (!found)
+		{
+			std::vector<u32> each;
+			for (u32 i = 0; i < Board::squids; ++i)
+			{
+				each.push_back(1u << i);
+			}
+			try_groups(goal, each);
+		}
+
+		/* Number the layouts by probability */
+		probabilities = all_layouts.probabilities;
+		std::vector<size_t> per_probability(probabilities.size(), 0);
+		for (const auto &layout : all_layouts.layouts)
+		{
+			per_probability[layout.probability]++;
+		}
+
+		std::vector<size_t> next(probabilities.size());
+		probability_begin.push_back(0);
+		for (size_t p = 0; p < probabilities.size(); ++p)
+		{
+			next[p] = 64 * probability_begin.back();
+			probability_begin.push_back(probability_begin.back() + (per_probability[p] + 63) / 64);
+		}
+		words = probability_begin.back();
+
+		/* The squares of every placement */
+		std::vector<std::vector<u32> > placement_squares[Board::squids];
+		for (u32 i = 0; i < Board::squids; ++i)
+		{
+			for (const mask &placement : all_layouts.placements[i])
+			{
+				placement_squares[i].emplace_back();
+				for (u32 square = 0; square < Board::squares; ++square)
+				{
+					if (placement & board::square_bit<mask>(square))
+					{
+						placement_squares[i].back().push_back(square);
+					}
+				}
+			}
+		}
+
+		const size_t stride = groups.size();
+		used.assign(words, 0);
+		covered.assign(Board::squares * words * stride, 0);
+		for (const auto &layout : all_layouts.layouts)
+		{
+			const size_t bit = next[layout.probability]++;
+			const size_t w = bit / 64;
+			const u64 b = 1ull << (bit % 64);
+
+			used[w] |= b;
+			for (u32 i = 0; i < Board::squids; ++i)
+			{
+				for (u32 g = 0; g < groups.size(); ++g)
+				{
+					if (!(groups[g] & (1u << i)))
+					{
+						continue;
+					}
+					for (u32 square : placement_squares[i][layout.squids[i]])
+					{
+						covered[(square * words + w) * stride + g] |= b;
+					}
+				}
+			}
+		}
+	}
+
+	/* The top best patterns of shots squares, best first */
+	std::vector<rated> search(u32 shots, u32 top)
+	{
+		PROFILE_SCOPE("exhaustive");
+
+		/* Chunks are the choices of the fixed highest squares */
+		const u32 fixed = std::min<u32>(shots, 2);
+		const u32 free = shots - fixed;
+
+		std::vector<std::pair<u32, u32> > chunks;
+		for (u32 a = 0; a < Board::squares; ++a)
+		{
+			if (fixed == 1 && free <= a)
+			{
+				chunks.emplace_back(a, a);
+			}
+			for (u32 b = 0; fixed == 2 && b < a; ++b)
+			{
+				if (free <= b)
+				{
+					chunks.emplace_back(a, b);
+				}
+			}
+		}
+
+		std::vector<std::vector<rated> > chunk_best(chunks.size());
+		std::atomic<u64> total_rated{0};
+
+		scheduler::parallel_for(0, chunks.size(), 1, [&] (size_t begin, size_t end)
+		{
+			const size_t stride = words * groups.size();
+
+			/* ors[j]: OR of squares c[j..free] and the fixed ones, for
+			 * j >= 2; ors[free+1] is the fixed squares alone */
+			std::vector<u64> ors((free + 2) * stride);
+			std::vector<u32> squares(shots);
+			u64 chunk_rated = 0;
+
+			for (size_t chunk = begin; chunk < end; ++chunk)
+			{
+				const u32 a = chunks[chunk].first;
+				const u32 b = chunks[chunk].second;
+				std::vector<rated> &best = chunk_best[chunk];
+
+				mask fixed_mask = board::square_bit<mask>(a);
+				squares[free] = a;
+				if (fixed == 2)
+				{
+					fixed_mask |= board::square_bit<mask>(b);
+					squares[free + 1] = b;
+				}
+
+				double fixed_value = 0.0;
+				u64 *fixed_or = &ors[(free + 1) * stride];
+				if (additive)
+				{
+					fixed_value = square_values[a] + (fixed == 2 ? square_values[b] : 0.0);
+				}
+				else
+				{
+					for (size_t k = 0; k < stride; ++k)
+					{
+						fixed_or[k] = covered[a * stride + k] | (fixed == 2 ? covered[b * stride + k] : 0);
+					}
+				}
+
+				combinations::revolving_door(fixed == 2 ? b : a, free, [&] (const u32 *c, u32 changed)
+				{
+					mask pattern = fixed_mask;
+					for (u32 j = 1; j <= free; ++j)
+					{
+						squares[j - 1] = c[j];
+						pattern |= board::square_bit<mask>(c[j]);
+					}
+
+					for (u32 j = changed; j >= 2 && !additive; --j)
+					{
+						const u64 *above = &ors[(j + 1) * stride];
+						const u64 *square = &covered[c[j] * stride];
+						u64 *current = &ors[j * stride];
+						for (size_t k = 0; k < stride; ++k)
+						{
+							current[k] = above[k] | square[k];
+						}
+					}
+
+					if (!canonical(squares.data(), shots, pattern))
+					{
+						return;
+					}
+
+					double rating = fixed_value;
+					if (additive)
+					{
+						for (u32 j = 1; j <= free; ++j)
+						{
+							rating += square_values[c[j]];
+						}
+					}
+					else
+					{
+						/* Without free squares, the fixed ones ORed
+						 * with themselves */
+						const u64 *above = free ? &ors[std::min<u32>(2, free + 1) * stride] : fixed_or;
+						const u64 *square = free ? &covered[c[1] * stride] : fixed_or;
+						rating = groups.size() == 1 ? rate_dispatched<1>(above, square) : rate_dispatched<Board::squids>(above, square);
+					}
+
+					keep(best, top, rated(rating, pattern));
+					chunk_rated++;
+				});
+			}
+
+			total_rated += chunk_rated;
+		});
+
+		std::vector<rated> result;
+		for (const auto &best : chunk_best)
+		{
+			result.insert(result.end(), best.begin(), best.end());
+		}
+		std::sort(result.begin(), result.end(), better);
+		if (result.size() > top)
+		{
+			result.resize(top);
+		}
+
+		rated_patterns = total_rated;
+		PROFILE_COUNT("exhaustive_patterns", rated_patterns);
+		return result;
+	}
+};
+
+enum class optimizer
+{
+	/* Race the candidates on up to twice the tests (see racing.h) */
+	race,
+
+	/* Rate every candidate on the same number of tests */
+	full,
+};
+
+struct ga_options
+{
+	u32 pattern_size = 8;
+	u32 population = 1 << 13;
+	u32 tests = 1 << 13;
+	optimizer kind = optimizer::race;
+};
+
+/* The random streams of a GA round, below the run's seed (see streams.h).
+ * Each is split into blocks of RANDOM_BLOCK patterns or layouts. */
+enum stream_name : u64
+{
+	PATTERN_STREAM = 1,
+	LAYOUT_STREAM,
+	MUTATION_STREAM,
+};
+
+const size_t RANDOM_BLOCK = 256;
+
+/* Fill up the population with random patterns */
+template<typename Board>
+void fill_population(u64 seed, u32 round, u32 pattern_size, u32 population, std::vector<std::pair<double, typename Board::mask> > &candidates)
+{
+	PROFILE_SCOPE("generate_patterns");
+
+	const size_t old_size = std::min<size_t>(candidates.size(), population);
+	PROFILE_COUNT("patterns_generated", population - old_size);
+	candidates.resize(population);
+
+	streams::parallel_blocks(seed, {PATTERN_STREAM, round}, population - old_size, RANDOM_BLOCK, [&] (size_t begin, size_t end, std::mt19937 &rng)
+	{
+		for (size_t i = old_size + begin; i < old_size + end; ++i)
+		{
+			candidates[i] = std::make_pair(0.0, generate_pattern<Board>(rng, pattern_size));
+		}
+	});
+}
+
+/* Generate a round's layouts up front so the candidates can be rated in
+ * parallel. All candidates see the layouts in the same order, so the
+ * result does not depend on the thread count. */
+template<typename Board>
+void generate_round_layouts(u64 seed, u32 round, std::vector<squid_layout<Board> > &layouts)
+{
+	PROFILE_SCOPE("generate_squids");
+	PROFILE_COUNT("layouts_generated", layouts.size());
+
+	streams::parallel_blocks(seed, {LAYOUT_STREAM, round}, layouts.size(), RANDOM_BLOCK, [&] (size_t begin, size_t end, std::mt19937 &rng)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			generate_squids(rng, layouts[i]);
+		}
+	});
+}
+
+/* Keep the better half of the candidates, ranked best first, and add a
+ * mutation of each of the better half of those */
+template<typename Board>
+void breed_candidates(u64 seed, u32 round, std::vector<std::pair<double, typename Board::mask> > &candidates)
+{
+	PROFILE_SCOPE("mutate");
+
+	candidates.resize(candidates.size() / 2);
+
+	const size_t old_size = candidates.size() / 2;
+	PROFILE_COUNT("mutations", old_size);
+	candidates.resize(old_size * 3);
+
+	streams::parallel_blocks(seed, {MUTATION_STREAM, round}, old_size, RANDOM_BLOCK, [&] (size_t begin, size_t end, std::mt19937 &rng)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			candidates[2 * old_size + i] = std::make_pair(0.0, mutate_pattern<Board>(rng, candidates[i].second));
+		}
+	});
+}
+
+/*
+ * The genetic algorithm, one round at a time. rate() fills up the
+ * population and ranks it on fresh layouts, best first, then breed()
+ * replaces the worse half by mutations of the better half. The survivors
+ * of every round are offered to a hall of fame, so a good pattern that
+ * was unlucky on a later round's layouts is not lost. They are offered by
+ * the lower end of their confidence interval, not their mean: a survivor
+ * that left the race early has a mean from few tests, which may just be
+ * lucky, and should not push out one that was tested on many.
+ */
+template<typename Board>
+class genetic_search
+{
+	ga_options options;
+	racing::options race_options;
+	goal_function<Board> goal;
+
+	/* The run's seed and the round being played, naming its streams */
+	u64 seed;
+	u32 round = 0;
+
+	std::vector<squid_layout<Board> > layouts;
+
+public:
+
+	/* Patterns the final rating looks at from the hall of fame */
+	static constexpr u32 HALL_SIZE = 100;
+
+	std::vector<std::pair<double, typename Board::mask> > candidates;
+	std::vector<racing::bounds> bounds;
+
+	/* The best survivors of all rounds by their round's lower bound */
+	hall_of_fame::hall<typename Board::mask> hall{HALL_SIZE};
+
+	genetic_search(const ga_options &opts, goal_function<Board> goal_fn, u64 run_seed)
+		: options(opts), goal(goal_fn), seed(run_seed)
+	{
+		if (options.kind == optimizer::race)
+		{
+			/* Candidates close to the selection boundary are raced on up
+			 * to twice the tests, the rest leave the race early. Spend at
+			 * most a quarter of rating every candidate on all tests. */
+			layouts.resize(options.tests * 2);
+			race_options.budget = static_cast<u64>(options.population) * options.tests / 4;
+		}
+		else
+		{
+			/* A single batch of all layouts: no candidate leaves early */
+			layouts.resize(options.tests);
+			race_options.first_batch = options.tests;
+		}
+	}
+
+	/* Returns the number of goal evaluations */
+	u64 rate()
+	{
+		fill_population<Board>(seed, round, options.pattern_size, options.population, candidates);
+		generate_round_layouts(seed, round, layouts);
+
+		/* Race the candidates for the half that survives this round */
+		u64 evaluations;
+		{
+			PROFILE_SCOPE("race");
+			evaluations = racing::race(candidates, candidates.size() / 2, layouts, goal, race_options, bounds);
+		}
+
+		PROFILE_SCOPE("hall_of_fame");
+		scheduler::parallel_for(0, candidates.size() / 2, 0, [&] (size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				hall.offer(bounds[i].lower(), candidates[i].second);
+			}
+		});
+		return evaluations;
+	}
+
+	/* Ends the round */
+	void breed()
+	{
+		breed_candidates<Board>(seed, round, candidates);
+		round++;
+	}
+};
+
+/*
+ * Multi-objective variant of genetic_search after NSGA-II (see pareto.h).
+ * Every candidate's hit_histogram over the same fresh layouts gives its
+ * mean for all goals, then the population is ranked by non-dominated front
+ * and crowding distance instead of a single score. There is no racing: it
+ * needs a single score to decide on.
+ */
+template<typename Board>
+class pareto_search
+{
+	ga_options options;
+	std::vector<hit_goal_function> goals;
+
+	u64 seed;
+	u32 round = 0;
+
+	std::vector<squid_layout<Board> > layouts;
+
+public:
+
+	/* In selection order. first is the mean of the first goal, for the
+	 * telemetry. */
+	std::vector<std::pair<double, typename Board::mask> > candidates;
+
+	/* The mean of every goal, the front and crowding distance of each
+	 * candidate */
+	std::vector<std::vector<double> > objectives;
+	std::vector<u32> fronts;
+	std::vector<double> crowding;
+
+	pareto_search(const ga_options &opts, const std::vector<named_goal<Board> > &named_goals, u64 run_seed)
+		: options(opts), seed(run_seed), layouts(opts.tests)
+	{
+		for (const auto &goal : named_goals)
+		{
+			goals.push_back(goal.of_hits);
+		}
+	}
+
+	/* Returns the number of goal evaluations */
+	u64 rate()
+	{
+		fill_population<Board>(seed, round, options.pattern_size, options.population, candidates);
+		generate_round_layouts(seed, round, layouts);
+
+		std::vector<std::vector<double> > means(candidates.size(), std::vector<double>(goals.size()));
+		{
+			PROFILE_SCOPE("pareto_evaluate");
+			scheduler::parallel_for(0, candidates.size(), 0, [&] (size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					hit_histogram<Board> h = hit_histogram<Board>::count(candidates[i].second, layouts);
+					for (size_t g = 0; g < goals.size(); ++g)
+					{
+						means[i][g] = h.total(goals[g]) / layouts.size();
+					}
+				}
+			});
+		}
+
+		PROFILE_SCOPE("pareto_sort");
+		std::vector<u32> candidate_fronts;
+		std::vector<double> candidate_crowding;
+		std::vector<size_t> order = pareto::rank(means, candidate_fronts, candidate_crowding);
+
+		std::vector<std::pair<double, typename Board::mask> > ranked;
+		objectives.clear();
+		fronts.clear();
+		crowding.clear();
+		for (size_t i : order)
+		{
+			ranked.emplace_back(means[i][0], candidates[i].second);
+			objectives.push_back(means[i]);
+			fronts.push_back(candidate_fronts[i]);
+			crowding.push_back(candidate_crowding[i]);
+		}
+		candidates = std::move(ranked);
+
+		/* One histogram bin per candidate and layout covers all goals */
+		const u64 evaluations = static_cast<u64>(candidates.size()) * layouts.size();
+		PROFILE_COUNT("goal_evaluations", evaluations);
+		return evaluations;
+	}
+
+	/* Ends the round */
+	void breed()
+	{
+		breed_candidates<Board>(seed, round, candidates);
+		round++;
+	}
+};
+
+/*
+ * Anytime performance of GA configurations: run every seed of a
+ * configuration for a wall-clock budget and record the exact rating of the
+ * best candidate found so far at fixed checkpoints. Rating the round's best
+ * candidate exactly is not counted against the budget. Curves are appended
+ * to a CSV file, so the runs of several configurations (population, tests,
+ * threads, optimizer) can be drawn on one chart.
+ */
+template<typename Board>
+int run_macro_benchmark(const ga_options &options, goal_function<Board> goal, const layout_table<Board> &all_layouts,
+						double budget, u64 first_seed, u32 seeds, double target, const char *curves_path)
+{
+	/* 1, 2, 5 steps up to the budget */
+	std::vector<double> checkpoints;
+	for (double decade = 0.1; decade < budget; decade *= 10.0)
+	{
+		for (double step : {1.0, 2.0, 5.0})
+		{
+			if (step * decade < budget)
+			{
+				checkpoints.push_back(step * decade);
+			}
+		}
+	}
+	checkpoints.push_back(budget);
+
+	FILE *curves = nullptr;
+	if (curves_path)
+	{
+		curves = std::fopen(curves_path, "a");
+		if (!curves)
+		{
+			cout << "Failed to open " << curves_path << endl;
+			return 1;
+		}
+
+		if (std::ftell(curves) == 0)
+		{
+			std::fprintf(curves, "population,tests,threads,optimizer,seed,seconds,best,rounds,evaluations\n");
+		}
+	}
+
+	const char *optimizer_name = options.kind == optimizer::race ? "race" : "full";
+	const u32 threads = scheduler::thread_count();
+
+	cout << "Population " << options.population << ", " << options.tests << " tests, " << threads << " threads, "
+		 << optimizer_name << ", " << budget << " s per seed" << '\n';
+
+	/* best[seed][checkpoint] */
+	std::vector<std::vector<double> > best(seeds, std::vector<double>(checkpoints.size(), 0.0));
+	std::vector<double> time_to_target(seeds, -1.0);
+
+	for (u32 seed = 0; seed < seeds; ++seed)
+	{
+		genetic_search<Board> search(options, goal, first_seed + seed);
+
+		double elapsed = 0.0;
+		double best_rating = 0.0;
+		u64 evaluations = 0;
+		u32 rounds = 0;
+		size_t checkpoint = 0;
+
+		while (checkpoint < checkpoints.size())
+		{
+			const auto round_start = std::chrono::steady_clock::now();
+			u64 round_evaluations = search.rate();
+			search.breed();
+			elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - round_start).count();
+
+			/* Checkpoints passed during this round get what was found
+			 * before it */
+			for (; checkpoint < checkpoints.size() && checkpoints[checkpoint] <= elapsed; ++checkpoint)
+			{
+				best[seed][checkpoint] = best_rating;
+				if (curves)
+				{
+					std::fprintf(curves, "%u,%u,%u,%s,%" PRIu64 ",%.3f,%.8f,%u,%" PRIu64 "\n", options.population, options.tests, threads,
+								 optimizer_name, first_seed + seed, checkpoints[checkpoint], best_rating, rounds, evaluations);
+				}
+			}
+
+			if (checkpoint == checkpoints.size())
+			{
+				break;
+			}
+
+			evaluations += round_evaluations;
+			++rounds;
+
+			/* The best candidate stays at the front after breeding */
+			best_rating = std::max(best_rating, exact_rating(search.candidates[0].second, all_layouts, goal));
+
+			if (time_to_target[seed] < 0.0 && best_rating >= target)
+			{
+				time_to_target[seed] = elapsed;
+			}
+		}
+
+		cout << "Seed " << first_seed + seed << ": best " << 100.0 * best_rating << "% after " << rounds << " rounds, ";
+		if (time_to_target[seed] >= 0.0)
+		{
+			cout << "target reached after " << time_to_target[seed] << " s" << '\n';
+		}
+		else
+		{
+			cout << "target not reached" << '\n';
+		}
+	}
+
+	if (curves)
+	{
+		std::fclose(curves);
+	}
+
+	/* Median over the seeds */
+	auto median = [] (std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		size_t n = values.size();
+		return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+	};
+
+	cout << "Median best:" << '\n';
+	for (size_t c = 0; c < checkpoints.size(); ++c)
+	{
+		std::vector<double> values(seeds);
+		for (u32 seed = 0; seed < seeds; ++seed)
+		{
+			values[seed] = best[seed][c];
+		}
+		cout << "  " << checkpoints[c] << " s: " << 100.0 * median(values) << "%" << '\n';
+	}
+
+	std::vector<double> reached;
+	for (double t : time_to_target)
+	{
+		if (t >= 0.0)
+		{
+			reached.push_back(t);
+		}
+	}
+
+	cout << "Target " << 100.0 * target << "% reached by " << reached.size() << " of " << seeds << " seeds";
+	if (!reached.empty())
+	{
+		cout << ", median time " << median(reached) << " s";
+	}
+	cout << endl;
+
+	return 0;
+}
+
+#ifndef SPLOOSHKABOOM_BENCH
+struct run_options
+{
+	ga_options ga;
+
+	/* 0: final results only, 1: one line per round, 2: best pattern and
+	 * the ten best and worst candidates of every round */
+	u32 verbosity = 2;
+	const char *telemetry_path = nullptr;
+	telemetry::format telemetry_format = telemetry::format::json;
+
+	/* Goals by name; more than one runs the multi-objective search */
+	std::vector<std::string> goals = {"at_least_1"};
+
+	/* Macro benchmark: seconds per seed (0: normal run) */
+	double macro_budget = 0.0;
+	u32 macro_seeds = 5;
+	double macro_target = 0.8704;
+	const char *curves_path = nullptr;
+
+	/* Rate every pattern of ga.pattern_size shots and print the top best
+	 * instead of running the GA */
+	bool exhaustive = false;
+	u32 top = 10;
+
+	/* Seed of all random streams, a random one unless given (the macro
+	 * benchmark's seeds count up from it, or from 1) */
+	u64 seed = 0;
+	bool has_seed = false;
+};
+
+/* The run's seed, printed so the run can be repeated */
+u64 run_seed(const run_options &opts)
+{
+	const u64 seed = opts.has_seed ? opts.seed : streams::random_seed();
+	cout << "Seed " << seed << endl;
+	return seed;
+}
+
+/* Boards with more layouts than this are rated on a random sample of
+ * SAMPLED_LAYOUTS layouts instead of all of them */
+const size_t MAX_LAYOUTS = 1 << 23;
+const u32 SAMPLED_LAYOUTS = 1 << 20;
+
+const u32 ROUNDS = 100;
+
+/* The exhaustive search takes about 4 us per pattern on one thread, so
+ * this is a few minutes (6 shots on the standard board) */
+const u64 MAX_EXHAUSTIVE_PATTERNS = 100000000;
+
+/*
+ * Multi-objective run: the rounds of pareto_search, then the best of the
+ * final population rated exactly on every goal, of which the
+ * non-dominated ones are printed.
+ */
+template<typename Board>
+int run_pareto(const run_options &opts, const std::vector<named_goal<Board> > &goals, const layout_table<Board> &all_layouts)
+{
+	const u32 verbosity = opts.verbosity;
+
+	telemetry::sink metrics;
+	if (opts.telemetry_path && !metrics.open(opts.telemetry_path, opts.telemetry_format))
+	{
+		cout << "Failed to open " << opts.telemetry_path << endl;
+		return 1;
+	}
+
+	pareto_search<Board> search(opts.ga, goals, run_seed(opts));
+	auto &candidates = search.candidates;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (u32 round = 0; round < ROUNDS; ++round)
+	{
+		const auto round_start = std::chrono::steady_clock::now();
+
+		if (verbosity >= 2)
+		{
+			cout << "Round " << round << '\n';
+		}
+
+		u64 evaluations = search.rate();
+
+		const auto now = std::chrono::steady_clock::now();
+
+		/* The telemetry follows the first goal */
+		{
+			PROFILE_SCOPE("telemetry");
+			telemetry::round_record record = telemetry::summarize(candidates, [] (const typename Board::mask &mask) { return board::to_hex(mask); });
+			record.round = round;
+			record.evaluations = evaluations;
+			record.evaluations_per_second = evaluations / std::chrono::duration<double>(now - round_start).count();
+			record.elapsed = std::chrono::duration<double>(now - start).count();
+			metrics.push(record);
+		}
+
+		const size_t front_size = std::count(search.fronts.begin(), search.fronts.end(), 0u);
+
+		if (verbosity == 1)
+		{
+			PROFILE_SCOPE("print");
+			cout << "Round " << round << ": front of " << front_size << ", best";
+			for (size_t g = 0; g < goals.size(); ++g)
+			{
+				double best = 0.0;
+				for (const auto &objective : search.objectives)
+				{
+					best = std::max(best, objective[g]);
+				}
+				cout << ' ' << goals[g].name << ' ' << 100.0 * best << '%';
+			}
+			cout << ", " << evaluations << " evaluations" << '\n';
+		}
+
+		if (verbosity >= 2)
+		{
+			PROFILE_SCOPE("print");
+
+			cout << "Evaluations: " << evaluations << '\n';
+			cout << "Front of " << front_size << ", most isolated:" << '\n';
+			for (size_t i = 0; i < std::min<size_t>(10, front_size); ++i)
+			{
+				for (size_t g = 0; g < goals.size(); ++g)
+				{
+					cout << (g ? " / " : "") << 100.0 * search.objectives[i][g] << '%';
+				}
+				cout << '\n';
+			}
+		}
+
+		/* The last round's ranking is the result */
+		if (round + 1 < ROUNDS)
+		{
+			search.breed();
+		}
+	}
+
+#if PROFILE_ENABLED
+	if (metrics.get_format() == telemetry::format::json)
+	{
+		metrics.push_line(profile::to_json());
+	}
+#endif
+	metrics.close();
+
+	cout << "Doing final rating.." << endl;
+
+	/* The N first distinct candidates in selection order */
+	const u32 N = 100;
+
+	std::vector<typename Board::mask> finalists;
+	for (const auto &candidate : candidates)
+	{
+		if (finalists.size() < N && std::find(finalists.begin(), finalists.end(), candidate.second) == finalists.end())
+		{
+			finalists.push_back(candidate.second);
+		}
+	}
+
+	std::vector<std::vector<double> > ratings(finalists.size());
+	scheduler::parallel_for(0, finalists.size(), 1, [&] (size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			ratings[i] = exact_ratings(finalists[i], all_layouts, goals);
+		}
+	});
+
+	std::vector<size_t> front = pareto::fronts(ratings)[0];
+	std::sort(front.begin(), front.end(), [&] (size_t a, size_t b) { return ratings[a] > ratings[b]; });
+
+	cout << "Pareto front (unique)" << endl;
+	for (size_t i = 0; i < front.size(); ++i)
+	{
+		cout << "#" << i+1;
+		print_square<Board>(finalists[front[i]]);
+		for (size_t g = 0; g < goals.size(); ++g)
+		{
+			cout << goals[g].name << ": " << 100.0 * ratings[front[i]][g] << "%" << endl;
+		}
+		cout << endl;
+	}
+
+	return 0;
+}
+
+/* Exhaustive run: the best patterns by exact rating, see exhaustive_search */
+template<typename Board>
+int run_exhaustive(const run_options &opts, const named_goal<Board> &goal, const layout_table<Board> &all_layouts)
+{
+	const u32 shots = opts.ga.pattern_size;
+	const bool expected_hits = goal.of_hits == &hit_goal::max_hits<Board>;
+
+	if (combinations::choose(Board::squares, shots) > MAX_EXHAUSTIVE_PATTERNS)
+	{
+		cout << "Too many patterns of " << shots << " shots to rate them all (more than " << MAX_EXHAUSTIVE_PATTERNS
+			 << "), pass fewer --shots" << endl;
+		return 1;
+	}
+
+	cout << "Rating all " << combinations::choose(Board::squares, shots) << " patterns of " << shots << " shots" << endl;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	exhaustive_search<Board> search(all_layouts, goal);
+	auto best = search.search(shots, opts.top);
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << search.rated_patterns << " distinct up to symmetry, rated in " << seconds << " s ("
+		 << search.rated_patterns / seconds << " patterns/s)" << endl;
+
+	cout << "Top " << best.size() << " (mirrored and rotated patterns left out)" << endl;
+	for (size_t i = 0; i < best.size(); ++i)
+	{
+		cout << "#" << i + 1;
+		print_square<Board>(best[i].second);
+		if (expected_hits)
+		{
+			cout << goal.name << ": " << best[i].first << endl;
+		}
+		else
+		{
+			cout << goal.name << ": " << 100.0 * best[i].first << "%" << endl;
+		}
+
+#if !NDEBUG
+		/* The same sums as exact_rating, so the same value */
+		double rating = exact_rating(best[i].second, all_layouts, goal.goal);
+		assert(expected_hits || rating == best[i].first);
+		assert(std::abs(rating - best[i].first) < 1e-9);
+#endif
+		cout << endl;
+	}
+
+	return 0;
+}
+
+template<typename Board>
+int run(const run_options &opts)
+{
+	std::vector<named_goal<Board> > goals;
+	for (const std::string &name : opts.goals)
+	{
+		const named_goal<Board> *goal = find_goal<Board>(name);
+		if (!goal)
+		{
+			cout << "Unknown goal " << name << endl;
+			return 1;
+		}
+		goals.push_back(*goal);
+	}
+
+	if (goals.size() > 1 && opts.macro_budget > 0.0)
+	{
+		cout << "The macro benchmark takes a single goal" << endl;
+		return 1;
+	}
+
+	if (goals.size() > 1 && opts.exhaustive)
+	{
+		cout << "The exhaustive search takes a single goal" << endl;
+		return 1;
+	}
+
+	const auto GOAL = goals[0].goal;
+
+	const ga_options &options = opts.ga;
+	const u32 verbosity = opts.verbosity;
+
+	layout_table<Board> all_layouts;
+	{
+		PROFILE_SCOPE("all_layouts");
+		all_layouts = generate_all_possible_squid_layouts<Board>(MAX_LAYOUTS);
+	}
+
+	if (all_layouts.empty())
+	{
+		cout << "Too many layouts to rate exactly, rating on " << SAMPLED_LAYOUTS << " random layouts instead" << endl;
+
+		std::mt19937 sample_rng(1);
+		all_layouts = layout_enumerator<Board>().sample(sample_rng, SAMPLED_LAYOUTS);
+	}
+
+	if (opts.exhaustive)
+	{
+		return run_exhaustive<Board>(opts, goals[0], all_layouts);
+	}
+
+	if (goals.size() > 1)
+	{
+		return run_pareto<Board>(opts, goals, all_layouts);
+	}
+
+	if (opts.macro_budget > 0.0)
+	{
+		return run_macro_benchmark<Board>(options, GOAL, all_layouts, opts.macro_budget,
+										  opts.has_seed ? opts.seed : 1, opts.macro_seeds, opts.macro_target, opts.curves_path);
+	}
+
+	/* One record per round as JSON lines or CSV */
+	telemetry::sink metrics;
+	if (opts.telemetry_path && !metrics.open(opts.telemetry_path, opts.telemetry_format))
+	{
+		cout << "Failed to open " << opts.telemetry_path << endl;
+		return 1;
+	}
+
+	genetic_search<Board> search(options, GOAL, run_seed(opts));
+	auto &candidates = search.candidates;
+	const auto &bounds = search.bounds;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	/* The hall of fame as of the last round */
+	std::vector<std::pair<double, typename Board::mask> > hall;
+	u64 hall_version = 0;
+
+	for (u32 round = 0; round < ROUNDS; ++round)
+	{
+		const auto round_start = std::chrono::steady_clock::now();
+
+		if (verbosity >= 2)
+		{
+			cout << "Round " << round << '\n';
+		}
+
+		u64 evaluations = search.rate();
+
+		const auto now = std::chrono::steady_clock::now();
+
+		if (search.hall.version() != hall_version)
+		{
+			hall_version = search.hall.version();
+			hall = search.hall.snapshot();
+		}
+
+		telemetry::round_record record;
+		{
+			PROFILE_SCOPE("telemetry");
+			record = telemetry::summarize(candidates, [] (const typename Board::mask &mask) { return board::to_hex(mask); });
+			record.round = round;
+			record.evaluations = evaluations;
+			record.evaluations_per_second = evaluations / std::chrono::duration<double>(now - round_start).count();
+			record.elapsed = std::chrono::duration<double>(now - start).count();
+			metrics.push(record);
+		}
+
+		if (verbosity == 1)
+		{
+			PROFILE_SCOPE("print");
+			cout << "Round " << round << ": best " << 100.0 * record.best << "%, median " << 100.0 * record.median
+				 << "%, worst " << 100.0 * record.worst << "%, " << evaluations << " evaluations" << '\n';
+		}
+
+		if (verbosity >= 2)
+		{
+			PROFILE_SCOPE("print");
+
+			cout << "Evaluations: " << evaluations << " ("
+				 << 100.0 * static_cast<double>(evaluations) / (static_cast<double>(candidates.size()) * options.tests)
+				 << "% of " << options.tests << " tests per candidate)" << '\n';
 
-		u32 old_size = candidates.size() / 2;
-		for (u32 i = 0; i < old_size; ++i)
-		{
-			candidates.emplace_back(0, mutate_pattern(rng, candidates[i].second));
+			const u32 shown = std::min<size_t>(10, candidates.size());
+
+			cout << "Best: " << '\n';
+			print_square<Board>(candidates[0].second);
+			for (u32 i = 0; i < shown; ++i)
+			{
+				cout << 100.0 * candidates[i].first << " +/- " << 100.0 * bounds[i].radius
+					 << " (" << bounds[i].tests << " tests)" << '\n';
+			}
+
+			cout << "Worst: " << '\n';
+			for (u32 i = 0; i < shown; ++i)
+			{
+				const size_t index = candidates.size() - i - 1;
+				cout << 100.0 * candidates[index].first << " +/- " << 100.0 * bounds[index].radius
+					 << " (" << bounds[index].tests << " tests)" << '\n';
+			}
+
+			cout << "Hall of fame: " << hall.size() << " patterns, lower bounds from " << 100.0 * hall.front().first
+				 << "% down to " << 100.0 * hall.back().first << "%" << '\n';
 		}
+
+		search.breed();
+	}
+
+#if PROFILE_ENABLED
+	/* The breakdown of the rounds; CSV has no room for it */
+	if (metrics.get_format() == telemetry::format::json)
+	{
+		metrics.push_line(profile::to_json());
 	}
+#endif
+	metrics.close();
 
-	/* Take N best performers from last round of GA and test against all combinations */
+	/* Take N best performers from last round of GA and the hall of fame and test against all combinations */
 	cout << "Doing final rating.." << endl;
 
-	/* Remove duplicates */
-	std::sort(candidates.begin(), candidates.end(), std::greater<>());
-	candidates.erase( std::unique( candidates.begin(), candidates.end() ), candidates.end() );
+	/* Remove duplicates, keeping the best score of each pattern */
+	auto remove_duplicates = [] (std::vector<std::pair<double, typename Board::mask> > &patterns)
+	{
+		std::sort(patterns.begin(), patterns.end(), std::greater<>());
+		std::stable_sort(patterns.begin(), patterns.end(), [] (const auto &a, const auto &b) { return a.second < b.second; });
+		patterns.erase(std::unique(patterns.begin(), patterns.end(), [] (const auto &a, const auto &b) { return a.second == b.second; }),
+					   patterns.end());
+		std::sort(patterns.begin(), patterns.end(), std::greater<>());
+	};
 
 	const u32 N = 100;
-	static_assert(N < CANDIDATE_POPULATION);
 
+	remove_duplicates(candidates);
 	candidates.resize(std::min(N, static_cast<u32>(candidates.size())));
-	for (auto &candidate : candidates)
+	candidates.insert(candidates.end(), hall.begin(), hall.end());
+	remove_duplicates(candidates);
+	scheduler::parallel_for(0, candidates.size(), 1, [&] (size_t begin, size_t end)
 	{
-		candidate.first = 0;
-
-		for (const auto &layout : all_layouts)
+		for (size_t i = begin; i < end; ++i)
 		{
-			candidate.first += GOAL(candidate.second, layout) * layout.probability;
+			candidates[i].first = exact_rating(candidates[i].second, all_layouts, GOAL);
 		}
-	}
+	});
 
 	std::sort(candidates.begin(), candidates.end(), std::greater<>());
 
@@ -469,10 +2391,563 @@ int main()
 	for (u32 i = 0; i < std::min(5, static_cast<int>(candidates.size())); ++i)
 	{
 		cout << "#" << i+1;
-		print_square(candidates.at(i).second);
+		print_square<Board>(candidates.at(i).second);
 		cout << "Probability: "
 			 << 100.0 * static_cast<double>(candidates.at(i).first)
 			 << "%"
-			 << endl << endl;
+			 << endl;
+
+		/* Every other goal comes from the same pass */
+		hit_histogram<Board> histogram = exact_histogram(candidates.at(i).second, all_layouts);
+		cout << "All goals:";
+		for (const auto &goal : all_goals<Board>())
+		{
+			/* max_hits is an expected number of hits, the rest are chances */
+			if (goal.of_hits == &hit_goal::max_hits<Board>)
+			{
+				cout << ' ' << goal.name << ' ' << histogram.total(goal.of_hits);
+			}
+			else
+			{
+				cout << ' ' << goal.name << ' ' << 100.0 * histogram.total(goal.of_hits) << '%';
+			}
+		}
+		cout << endl << endl;
+	}
+
+	return 0;
+}
+
+void print_usage(const char *program)
+{
+	cout << "Usage: " << program << " [options]\n"
+		 << "  --goal <goal>[,<goal>...]      what a pattern is rated by\n"
+		 << "  --board 8x8|10x10|battleship|12x12\n"
+		 << "  --shots <n>                    shots in a pattern\n"
+		 << "  --population <n>               candidates per round\n"
+		 << "  --tests <n>                    layouts per round\n"
+		 << "  --optimizer race|full          how candidates are rated\n"
+		 << "  --threads <n>                  worker threads, 0 for every CPU\n"
+		 << "  --seed <n>                     seed of all random streams\n"
+		 << "  --verbosity 0|1|2              what is printed per round\n"
+		 << "  --telemetry <file>             per round records, - for stdout\n"
+		 << "  --telemetry-format json|csv\n"
+		 << "  --macro <seconds>              time budget per seed\n"
+		 << "  --seeds <n>                    seeds for --macro\n"
+		 << "  --target <percent>             rating --macro counts as solved\n"
+		 << "  --curves <file>                --macro progress as CSV\n"
+		 << "  --exhaustive                   rate every pattern of --shots\n"
+		 << "  --top <n>                      best patterns --exhaustive prints" << endl;
+}
+
+int main(int argc, char **argv)
+{
+	PROFILE_REPORT_AT_EXIT();
+
+	run_options opts;
+	const char *board_name = "8x8";
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 < argc && std::strcmp(argv[i], "--verbosity") == 0)
+		{
+			opts.verbosity = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--telemetry") == 0)
+		{
+			opts.telemetry_path = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--telemetry-format") == 0)
+		{
+			if (!telemetry::parse_format(argv[++i], opts.telemetry_format))
+			{
+				cout << "Unknown telemetry format '" << argv[i] << "' (expected json or csv)" << endl;
+				return 1;
+			}
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--goal") == 0)
+		{
+			/* Comma separated */
+			opts.goals.clear();
+			std::string list = argv[++i];
+			for (size_t begin = 0, end; begin <= list.size(); begin = end + 1)
+			{
+				end = std::min(list.find(',', begin), list.size());
+				opts.goals.push_back(list.substr(begin, end - begin));
+			}
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--board") == 0)
+		{
+			board_name = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--shots") == 0)
+		{
+			opts.ga.pattern_size = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--population") == 0)
+		{
+			opts.ga.population = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--tests") == 0)
+		{
+			opts.ga.tests = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--optimizer") == 0)
+		{
+			std::string kind = argv[++i];
+			if (kind == "race")
+			{
+				opts.ga.kind = optimizer::race;
+			}
+			else if (kind == "full")
+			{
+				opts.ga.kind = optimizer::full;
+			}
+			else
+			{
+				cout << "Unknown optimizer '" << kind << "' (expected race or full)" << endl;
+				return 1;
+			}
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--threads") == 0)
+		{
+			/* 0: every CPU we may run on */
+			u32 threads = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+			scheduler::set_thread_count(threads ? threads : scheduler::default_thread_count());
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--macro") == 0)
+		{
+			opts.macro_budget = std::strtod(argv[++i], nullptr);
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--seeds") == 0)
+		{
+			opts.macro_seeds = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--target") == 0)
+		{
+			opts.macro_target = std::strtod(argv[++i], nullptr) / 100.0;
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--curves") == 0)
+		{
+			opts.curves_path = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--seed") == 0)
+		{
+			if (!streams::parse_seed(argv[++i], opts.seed))
+			{
+				cout << "Seed must be a number" << endl;
+				return 1;
+			}
+			opts.has_seed = true;
+		}
+		else if (std::strcmp(argv[i], "--exhaustive") == 0)
+		{
+			opts.exhaustive = true;
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--top") == 0)
+		{
+			opts.top = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else
+		{
+			cout << "Unknown option or missing value: " << argv[i] << endl;
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (opts.ga.population < 4 || opts.ga.tests == 0 || opts.macro_seeds == 0 || opts.ga.pattern_size == 0)
+	{
+		cout << "Population must be at least 4, shots, tests and seeds at least 1" << endl;
+		return 1;
+	}
+
+	if (opts.exhaustive && opts.top == 0)
+	{
+		cout << "--top must be at least 1" << endl;
+		return 1;
+	}
+
+	/* Every variant is compiled separately, with its own mask type */
+	if (std::strcmp(board_name, "8x8") == 0)
+	{
+		return run<board::standard>(opts);
+	}
+	if (std::strcmp(board_name, "10x10") == 0)
+	{
+		return run<board::config<10, 10, 2, 3, 4> >(opts);
+	}
+	if (std::strcmp(board_name, "battleship") == 0)
+	{
+		return run<board::config<10, 10, 2, 3, 3, 4, 5> >(opts);
+	}
+	if (std::strcmp(board_name, "12x12") == 0)
+	{
+		return run<board::config<12, 12, 2, 3, 4, 5> >(opts);
+	}
+
+	cout << "Unknown board " << board_name << " (8x8, 10x10, battleship or 12x12)" << endl;
+	return 1;
+}
+#endif
+
+#ifdef SPLOOSHKABOOM_BENCH
+/* Kernel benchmarks, see bench.h. Built by make bench. */
+#include "bench.h"
+
+const u32 BENCH_LAYOUTS = 4096;
+const u32 BENCH_CANDIDATES = 64;
+const u32 BENCH_CALLS = 1024;
+
+typedef board::standard bench_board;
+
+/* Rule variants, for the generic mask types */
+typedef board::config<10, 10, 2, 3, 4> bench_board_10x10;
+typedef board::config<12, 12, 2, 3, 4, 5> bench_board_12x12;
+
+template<typename Board>
+std::vector<squid_layout<Board> > bench_random_layouts(std::mt19937 &rng, u32 n)
+{
+	std::vector<squid_layout<Board> > layouts(n);
+	for (auto &layout : layouts)
+	{
+		generate_squids(rng, layout);
+	}
+	return layouts;
+}
+
+/* nth_set as dispatched, or one implementation from bits.h */
+template<square_mask (*SELECT)(u32, square_mask)>
+void bench_select(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+
+	std::vector<square_mask> masks(BENCH_CALLS);
+	std::vector<u32> ns(BENCH_CALLS);
+	for (u32 i = 0; i < BENCH_CALLS; ++i)
+	{
+		masks[i] = generate_pattern<bench_board>(rng, 1 + randint(rng, 62));
+		ns[i] = randint(rng, __builtin_popcountll(masks[i]) - 1);
+	}
+
+	while (s.keep_running())
+	{
+		square_mask selected = 0;
+		for (u32 i = 0; i < BENCH_CALLS; ++i)
+		{
+			selected ^= SELECT(ns[i], masks[i]);
+		}
+		bench::do_not_optimize(selected);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "calls");
+}
+
+square_mask bench_nth_set(u32 n, square_mask mask)
+{
+	return nth_set(n, mask);
+}
+
+static bench::registration bench_selects[] =
+{
+	{"nth_set", bench_select<bench_nth_set>},
+	{"select_broadword", bench_select<bits::select_broadword>},
+	{"select_table", bench_select<bits::select_table>},
+};
+
+/* PDEP only where the CPU has it */
+static const bool bench_select_pdep = __builtin_cpu_supports("bmi2")
+	&& (bench::registration("select_pdep", bench_select<bits::select_pdep>), true);
+
+void bench_insert_squid(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts<bench_board>(rng, BENCH_CALLS);
+
+	while (s.keep_running())
+	{
+		square_mask bits = 0;
+		for (const auto &layout : layouts)
+		{
+			bits ^= insert_squid<bench_board>(layout.squids[0] | layout.squids[1], 4, rng);
+		}
+		bench::do_not_optimize(bits);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "squids");
+}
+BENCHMARK(bench_insert_squid);
+
+template<typename Board>
+void bench_generate_squids(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	std::vector<squid_layout<Board> > layouts(BENCH_CALLS);
+
+	while (s.keep_running())
+	{
+		for (auto &layout : layouts)
+		{
+			generate_squids(rng, layout);
+		}
+		bench::do_not_optimize(layouts[0]);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "layouts");
+}
+
+template<typename Board>
+void bench_generate_pattern(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+
+	while (s.keep_running())
+	{
+		typename Board::mask bits = 0;
+		for (u32 i = 0; i < BENCH_CALLS; ++i)
+		{
+			bits ^= generate_pattern<Board>(rng, 8);
+		}
+		bench::do_not_optimize(bits);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "patterns");
+}
+
+template<typename Board>
+void bench_mutate_pattern(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	typename Board::mask pattern = generate_pattern<Board>(rng, 8);
+
+	while (s.keep_running())
+	{
+		for (u32 i = 0; i < BENCH_CALLS; ++i)
+		{
+			pattern = mutate_pattern<Board>(rng, pattern);
+		}
+		bench::do_not_optimize(pattern);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "patterns");
+}
+
+/* Rate BENCH_CANDIDATES patterns on BENCH_LAYOUTS layouts with one goal */
+template<typename Board, goal_function<Board> GOAL>
+void bench_goal(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts<Board>(rng, BENCH_LAYOUTS);
+
+	std::vector<typename Board::mask> candidates(BENCH_CANDIDATES);
+	for (auto &candidate : candidates)
+	{
+		candidate = generate_pattern<Board>(rng, 8);
+	}
+
+	while (s.keep_running())
+	{
+		u64 total = 0;
+		for (const auto &candidate : candidates)
+		{
+			for (const auto &layout : layouts)
+			{
+				total += GOAL(candidate, layout);
+			}
+		}
+		bench::do_not_optimize(total);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(BENCH_CANDIDATES) * BENCH_LAYOUTS, "candidate*layouts");
+}
+
+/* Rate BENCH_CANDIDATES patterns on BENCH_LAYOUTS layouts for all goals at
+ * once, as a hit_histogram */
+template<typename Board>
+void bench_hit_histogram(bench::state &s)
+{
+	typedef hit_histogram<Board> histogram;
+
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts<Board>(rng, BENCH_LAYOUTS);
+
+	std::vector<typename Board::mask> candidates(BENCH_CANDIDATES);
+	for (auto &candidate : candidates)
+	{
+		candidate = generate_pattern<Board>(rng, 8);
+	}
+
+	while (s.keep_running())
+	{
+		for (const auto &candidate : candidates)
+		{
+			histogram h = histogram::count(candidate, layouts);
+			bench::do_not_optimize(h);
+		}
+	}
+
+	s.set_items_per_iteration(static_cast<double>(BENCH_CANDIDATES) * BENCH_LAYOUTS, "candidate*layouts");
+}
+
+/* Exact enumeration of every layout */
+template<typename Board>
+void bench_all_layouts(bench::state &s)
+{
+	size_t count = 0;
+
+	while (s.keep_running())
+	{
+		auto layouts = generate_all_possible_squid_layouts<Board>(SIZE_MAX);
+		count = layouts.size();
+		bench::do_not_optimize(layouts.layouts[0]);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(count), "layouts");
+}
+
+/* Exhaustive search over every pattern of three shots on all layouts */
+void bench_exhaustive(bench::state &s)
+{
+	auto layouts = generate_all_possible_squid_layouts<bench_board>(SIZE_MAX);
+	exhaustive_search<bench_board> search(layouts, *find_goal<bench_board>("at_least_1"));
+
+	while (s.keep_running())
+	{
+		auto best = search.search(3, 10);
+		bench::do_not_optimize(best[0]);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(search.rated_patterns), "patterns");
+}
+
+static bench::registration bench_kernels[] =
+{
+	{"generate_squids", bench_generate_squids<bench_board>},
+	{"generate_pattern", bench_generate_pattern<bench_board>},
+	{"mutate_pattern", bench_mutate_pattern<bench_board>},
+	{"goal_at_least_1", bench_goal<bench_board, optimization_goal::at_least_1<bench_board> >},
+	{"goal_at_least_2", bench_goal<bench_board, optimization_goal::at_least_2<bench_board> >},
+	{"goal_at_least_3", bench_goal<bench_board, optimization_goal::at_least_3<bench_board> >},
+	{"goal_find_squid_2", bench_goal<bench_board, optimization_goal::find_squid_2<bench_board> >},
+	{"goal_find_squid_3", bench_goal<bench_board, optimization_goal::find_squid_3<bench_board> >},
+	{"goal_find_squid_4", bench_goal<bench_board, optimization_goal::find_squid_4<bench_board> >},
+	{"goal_max_hits", bench_goal<bench_board, optimization_goal::max_hits<bench_board> >},
+	{"goal_find_0", bench_goal<bench_board, optimization_goal::find_0<bench_board> >},
+	{"goal_find_1", bench_goal<bench_board, optimization_goal::find_1<bench_board> >},
+	{"goal_find_2", bench_goal<bench_board, optimization_goal::find_2<bench_board> >},
+	{"hit_histogram", bench_hit_histogram<bench_board>},
+	{"all_layouts", bench_all_layouts<bench_board>},
+	{"exhaustive", bench_exhaustive},
+
+	/* 128-bit and multi-word masks */
+	{"generate_squids_10x10", bench_generate_squids<bench_board_10x10>},
+	{"mutate_pattern_10x10", bench_mutate_pattern<bench_board_10x10>},
+	{"goal_at_least_2_10x10", bench_goal<bench_board_10x10, optimization_goal::at_least_2<bench_board_10x10> >},
+	{"all_layouts_10x10", bench_all_layouts<bench_board_10x10>},
+	{"hit_histogram_10x10", bench_hit_histogram<bench_board_10x10>},
+	{"generate_squids_12x12", bench_generate_squids<bench_board_12x12>},
+	{"mutate_pattern_12x12", bench_mutate_pattern<bench_board_12x12>},
+	{"goal_at_least_2_12x12", bench_goal<bench_board_12x12, optimization_goal::at_least_2<bench_board_12x12> >},
+	{"hit_histogram_12x12", bench_hit_histogram<bench_board_12x12>},
+};
+
+/* One GA round's racing evaluation, scaled down */
+void bench_race_round(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts<bench_board>(rng, BENCH_LAYOUTS);
+
+	std::vector<std::pair<double, square_mask> > population;
+	for (u32 i = 0; i < 1024; ++i)
+	{
+		population.emplace_back(0, generate_pattern<bench_board>(rng, 8));
+	}
+
+	racing::options race_options;
+	std::vector<racing::bounds> bounds;
+	u64 evaluations = 0;
+
+	while (s.keep_running())
+	{
+		auto candidates = population;
+		evaluations = racing::race(candidates, candidates.size() / 2, layouts, optimization_goal::at_least_1<bench_board>, race_options, bounds);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(evaluations), "candidate*layouts");
+}
+BENCHMARK(bench_race_round);
+
+/* NSGA-II ranking of a population of 8192 on three goals */
+void bench_pareto_rank(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts<bench_board>(rng, 1024);
+
+	const goal_function<bench_board> goals[] =
+	{
+		optimization_goal::at_least_1<bench_board>,
+		optimization_goal::at_least_2<bench_board>,
+		optimization_goal::at_least_3<bench_board>,
+	};
+
+	/* Means of random patterns on a few layouts, with ties like in a run */
+	std::vector<std::vector<double> > objectives(8192, std::vector<double>(3, 0.0));
+	for (auto &objective : objectives)
+	{
+		square_mask pattern = generate_pattern<bench_board>(rng, 8);
+		for (const auto &layout : layouts)
+		{
+			for (u32 g = 0; g < 3; ++g)
+			{
+				objective[g] += goals[g](pattern, layout) / 1024.0;
+			}
+		}
+	}
+
+	std::vector<u32> fronts;
+	std::vector<double> crowding;
+	while (s.keep_running())
+	{
+		auto order = pareto::rank(objectives, fronts, crowding);
+		bench::do_not_optimize(order[0]);
+	}
+
+	s.set_items_per_iteration(objectives.size(), "candidates");
+}
+BENCHMARK(bench_pareto_rank);
+
+/* Offers of a GA run's worth of random scores to a hall of 100, in
+ * parallel */
+void bench_hall_of_fame(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	std::uniform_real_distribution<double> score(0.0, 1.0);
+
+	std::vector<std::pair<double, square_mask> > offers;
+	for (u32 i = 0; i < (1 << 16); ++i)
+	{
+		offers.emplace_back(score(rng), generate_pattern<bench_board>(rng, 8));
+	}
+
+	while (s.keep_running())
+	{
+		hall_of_fame::hall<square_mask> hall(100);
+		scheduler::parallel_for(0, offers.size(), 0, [&] (size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				hall.offer(offers[i].first, offers[i].second);
+			}
+		});
+		bench::do_not_optimize(hall.floor());
 	}
+
+	s.set_items_per_iteration(offers.size(), "offers");
 }
+BENCHMARK(bench_hall_of_fame);
+
+int main(int argc, char **argv)
+{
+	return bench::main(argc, argv);
+}
+#endif
@@ -1,9 +1,11 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <random>
@@ -15,6 +17,14 @@ extern "C"
 #include <x86intrin.h>
 }
 
+#include "bits.h"
+#include "board.h"
+#include "profile.h"
+#include "racing.h"
+#include "scheduler.h"
+#include "streams.h"
+#include "telemetry.h"
+
 using std::cout;
 using std::endl;
 
@@ -59,7 +69,7 @@ void print_square(square_mask mask)
 	{
 		cout << "---+";
 	}
-	cout << endl;
+	cout << '\n';
 
 	for (u32 y = 0; y < WIDTH; ++y)
 	{
@@ -68,14 +78,14 @@ void print_square(square_mask mask)
 		{
 			cout << (square_get(mask, x, y) ? " X |" : "   |");
 		}
-		cout << endl;
+		cout << '\n';
 
 		cout << "+";
 		for (u32 x = 0; x < WIDTH; ++x)
 		{
 			cout << "---+";
 		}
-		cout << endl;
+		cout << '\n';
 	}
 }
 
@@ -114,6 +124,11 @@ square_mask insert_squid(square_mask current, u32 squid_length, std::mt19937 &rn
 				square_set(new_squid, x, y+i);
 			}
 		}
+
+		if ((current & new_squid) != 0)
+		{
+			PROFILE_COUNT("insert_squid_retries", 1);
+		}
 	} while ((current & new_squid) != 0);
 
 	return new_squid;
@@ -135,24 +150,7 @@ square_mask nth_set(u32 n, square_mask mask)
 {
 	assert(n < __builtin_popcountll(mask));
 
-	return _pdep_u64(1ull << n, mask);
-
-	/* Non-BMI2 implementation in case your CPU lacks HW support: */
-
-	/* for (u32 bit = 0; bit < 64; bit++) */
-	/* { */
-	/* 	if (mask & (1ull << bit)) */
-	/* 	{ */
-	/* 		if (n == 0) */
-	/* 		{ */
-	/* 			return 1ull << bit; */
-	/* 		} */
-	/* 		n--; */
-	/* 	} */
-	/* } */
-
-	/* assert(0); */
-	/* return 0; */
+	return bits::select_bit(n, mask);
 }
 
 square_mask generate_squid(u32 size, u32 x, u32 y, bool horizontal)
@@ -251,7 +249,7 @@ std::vector<squid_layout> generate_all_possible_squid_layouts()
 	cout << "Maximum layout probability: " << max << endl;
 #endif
 
-	return std::move(layouts);
+	return layouts;
 }
 
 
@@ -325,7 +323,7 @@ struct start_pattern
 		{
 			cout << "----+";
 		}
-		cout << endl;
+		cout << '\n';
 
 		for (u32 y = 0; y < WIDTH; ++y)
 		{
@@ -345,14 +343,14 @@ struct start_pattern
 
 				cout << " |";
 			}
-			cout << endl;
+			cout << '\n';
 
 			cout << "+";
 			for (u32 x = 0; x < WIDTH; ++x)
 			{
 				cout << "----+";
 			}
-			cout << endl;
+			cout << '\n';
 		}
 	}
 
@@ -426,75 +424,226 @@ namespace optimization_goal
 	}
 }
 
-int main()
+#ifndef SPLOOSHKABOOM_BENCH
+void print_usage(const char *program)
+{
+	cout << "Usage: " << program << " [options]\n"
+		 << "  --seed <n>                     seed of all random streams\n"
+		 << "  --verbosity 0|1|2              what is printed per round\n"
+		 << "  --telemetry <file>             per round records, - for stdout\n"
+		 << "  --telemetry-format json|csv" << endl;
+}
+
+int main(int argc, char **argv)
 {
+	PROFILE_REPORT_AT_EXIT();
+
 	const u32 PATTERN_SIZE = 8;
 	const u32 CANDIDATE_POPULATION = 1 << 13;
 	const u32 TESTS = 1 << 13;
 	const u32 ROUNDS = 100;
 
+	/* Candidates close to the selection boundary are raced on up to this
+	 * many layouts, the rest leave the race early */
+	const u32 MAX_TESTS = TESTS * 2;
+
 	const auto GOAL = optimization_goal::fast_hit<PATTERN_SIZE>;
 
-	std::random_device dev;
-	std::mt19937 rng(dev());
+	/* Spend at most a quarter of rating every candidate on TESTS layouts */
+	racing::options race_options;
+	race_options.budget = static_cast<u64>(CANDIDATE_POPULATION) * TESTS / 4;
+
+	/* 0: final results only, 1: one line per round, 2: best pattern and
+	 * the ten best and worst candidates of every round */
+	u32 verbosity = 2;
+	const char *telemetry_path = nullptr;
+	telemetry::format telemetry_format = telemetry::format::json;
+
+	/* Seed of all random streams (see streams.h), a random one unless
+	 * given */
+	u64 seed = 0;
+	bool has_seed = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 < argc && std::strcmp(argv[i], "--verbosity") == 0)
+		{
+			verbosity = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--telemetry") == 0)
+		{
+			telemetry_path = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--telemetry-format") == 0)
+		{
+			if (!telemetry::parse_format(argv[++i], telemetry_format))
+			{
+				cout << "Unknown telemetry format '" << argv[i] << "' (expected json or csv)" << endl;
+				return 1;
+			}
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--seed") == 0)
+		{
+			if (!streams::parse_seed(argv[++i], seed))
+			{
+				cout << "Seed must be a number" << endl;
+				return 1;
+			}
+			has_seed = true;
+		}
+		else
+		{
+			cout << "Unknown option or missing value: " << argv[i] << endl;
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* One record per round as JSON lines or CSV */
+	telemetry::sink metrics;
+	if (telemetry_path && !metrics.open(telemetry_path, telemetry_format))
+	{
+		cout << "Failed to open " << telemetry_path << endl;
+		return 1;
+	}
+
+	/* The streams of a round: patterns and mutations are drawn in order,
+	 * layouts in blocks of LAYOUT_BLOCK */
+	enum : u64
+	{
+		PATTERN_STREAM = 1,
+		LAYOUT_STREAM,
+		MUTATION_STREAM,
+	};
+	const size_t LAYOUT_BLOCK = 256;
+
+	if (!has_seed)
+	{
+		seed = streams::random_seed();
+	}
+	cout << "Seed " << seed << endl;
 
 	std::vector<std::pair<double, start_pattern<PATTERN_SIZE> > > candidates;
 
-	auto all_layouts = generate_all_possible_squid_layouts();
+	std::vector<squid_layout> all_layouts;
+	{
+		PROFILE_SCOPE("all_layouts");
+		all_layouts = generate_all_possible_squid_layouts();
+	}
+
+	std::vector<squid_layout> layouts(MAX_TESTS);
+	std::vector<racing::bounds> bounds;
+
+	const auto start = std::chrono::steady_clock::now();
 
 	for (u32 round = 0; round < ROUNDS; ++round)
 	{
-		cout << "Round " << round << endl;
+		const auto round_start = std::chrono::steady_clock::now();
 
-		for (auto &candidate : candidates)
+		if (verbosity >= 2)
 		{
-			candidate.first = 0;
+			cout << "Round " << round << '\n';
 		}
 
-		while(candidates.size() < CANDIDATE_POPULATION)
 		{
-			candidates.emplace_back(0, start_pattern<PATTERN_SIZE>(rng));
+			PROFILE_SCOPE("generate_patterns");
+			PROFILE_COUNT("patterns_generated", CANDIDATE_POPULATION - candidates.size());
+			std::mt19937 rng = streams::generator(seed, {PATTERN_STREAM, round});
+			while(candidates.size() < CANDIDATE_POPULATION)
+			{
+				candidates.emplace_back(0, start_pattern<PATTERN_SIZE>(rng));
+			}
 		}
 
-		for (u32 test = 0; test < TESTS; ++test)
+		/* Generate this round's layouts up front so the candidates can be
+		 * rated in parallel. All candidates see the layouts in the same
+		 * order, so the result does not depend on the thread count. */
 		{
-			squid_layout layout;
-			generate_squids(rng, layout);
-
-			for (auto &candidate : candidates)
+			PROFILE_SCOPE("generate_squids");
+			PROFILE_COUNT("layouts_generated", layouts.size());
+			streams::parallel_blocks(seed, {LAYOUT_STREAM, round}, layouts.size(), LAYOUT_BLOCK, [&] (size_t begin, size_t end, std::mt19937 &rng)
 			{
-				candidate.first += GOAL(candidate.second, layout);
-			}
+				for (size_t i = begin; i < end; ++i)
+				{
+					generate_squids(rng, layouts[i]);
+				}
+			});
 		}
 
-		std::sort(candidates.begin(), candidates.end(), std::greater<>());
+		/* Race the candidates for the half that survives this round */
+		u64 evaluations;
+		{
+			PROFILE_SCOPE("race");
+			evaluations = racing::race(candidates, candidates.size() / 2, layouts, GOAL, race_options, bounds);
+		}
+
+		const auto now = std::chrono::steady_clock::now();
 
-		cout << "Best: " << endl;
-		candidates[0].second.print();
-		for (u32 i = 0; i < 10; ++i)
+		telemetry::round_record record;
 		{
-			auto &candidate = candidates[i];
-			u64 hits = candidate.first;
-			cout << 100.0 * static_cast<float>(hits) / static_cast<float>(TESTS) << endl;
+			PROFILE_SCOPE("telemetry");
+			record = telemetry::summarize(candidates, [] (const start_pattern<PATTERN_SIZE> &pattern) { return board::to_hex(pattern.get_mask()); });
+			record.round = round;
+			record.evaluations = evaluations;
+			record.evaluations_per_second = evaluations / std::chrono::duration<double>(now - round_start).count();
+			record.elapsed = std::chrono::duration<double>(now - start).count();
+			metrics.push(record);
 		}
 
-		cout << "Worst: " << endl;
-		for (u32 i = 0; i < 10; ++i)
+		if (verbosity == 1)
 		{
-			auto &candidate = candidates[candidates.size() - i - 1];
-			u64 hits = candidate.first;
-			cout << 100.0 * static_cast<float>(hits) / static_cast<float>(TESTS) << endl;
+			PROFILE_SCOPE("print");
+			cout << "Round " << round << ": best " << 100.0 * record.best << "%, median " << 100.0 * record.median
+				 << "%, worst " << 100.0 * record.worst << "%, " << evaluations << " evaluations" << '\n';
 		}
 
+		if (verbosity >= 2)
+		{
+			PROFILE_SCOPE("print");
+
+			cout << "Evaluations: " << evaluations << " ("
+				 << 100.0 * static_cast<double>(evaluations) / (static_cast<double>(candidates.size()) * TESTS)
+				 << "% of " << TESTS << " tests per candidate)" << '\n';
+
+			cout << "Best: " << '\n';
+			candidates[0].second.print();
+			for (u32 i = 0; i < 10; ++i)
+			{
+				cout << 100.0 * candidates[i].first << " +/- " << 100.0 * bounds[i].radius
+					 << " (" << bounds[i].tests << " tests)" << '\n';
+			}
+
+			cout << "Worst: " << '\n';
+			for (u32 i = 0; i < 10; ++i)
+			{
+				const size_t index = candidates.size() - i - 1;
+				cout << 100.0 * candidates[index].first << " +/- " << 100.0 * bounds[index].radius
+					 << " (" << bounds[index].tests << " tests)" << '\n';
+			}
+		}
+
+		PROFILE_SCOPE("mutate");
+
 		candidates.resize(candidates.size() / 2);
 
 		u32 old_size = candidates.size() / 2;
+		PROFILE_COUNT("mutations", old_size);
+		std::mt19937 rng = streams::generator(seed, {MUTATION_STREAM, round});
 		for (u32 i = 0; i < old_size; ++i)
 		{
 			candidates.emplace_back(0, candidates[i].second.mutated(rng));
 		}
 	}
 
+#if PROFILE_ENABLED
+	/* The breakdown of the rounds; CSV has no room for it */
+	if (metrics.get_format() == telemetry::format::json)
+	{
+		metrics.push_line(profile::to_json());
+	}
+#endif
+	metrics.close();
+
 	/* Take N best performers from last round of GA and test against all combinations */
 	cout << "Doing final rating.." << endl;
 
@@ -506,14 +655,21 @@ int main()
 	static_assert(N < CANDIDATE_POPULATION);
 
 	candidates.resize(std::min(N, static_cast<u32>(candidates.size())));
-	for (auto &candidate : candidates)
 	{
-		candidate.first = 0;
-
-		for (const auto &layout : all_layouts)
+		PROFILE_SCOPE("final_rating");
+		scheduler::parallel_for(0, candidates.size(), 1, [&] (size_t begin, size_t end)
 		{
-			candidate.first += GOAL(candidate.second, layout) * layout.probability;
-		}
+			for (size_t i = begin; i < end; ++i)
+			{
+				auto &candidate = candidates[i];
+				candidate.first = 0;
+
+				for (const auto &layout : all_layouts)
+				{
+					candidate.first += GOAL(candidate.second, layout) * layout.probability;
+				}
+			}
+		});
 	}
 
 	std::sort(candidates.begin(), candidates.end(), std::greater<>());
@@ -529,3 +685,153 @@ int main()
 			 << endl << endl;
 	}
 }
+#endif
+
+#ifdef SPLOOSHKABOOM_BENCH
+/* Kernel benchmarks, see bench.h. Built by make bench. */
+#include "bench.h"
+
+const u32 BENCH_PATTERN_SIZE = 8;
+const u32 BENCH_LAYOUTS = 4096;
+const u32 BENCH_CANDIDATES = 64;
+const u32 BENCH_CALLS = 1024;
+
+typedef start_pattern<BENCH_PATTERN_SIZE> bench_pattern;
+
+std::vector<squid_layout> bench_random_layouts(std::mt19937 &rng, u32 n)
+{
+	std::vector<squid_layout> layouts(n);
+	for (auto &layout : layouts)
+	{
+		generate_squids(rng, layout);
+	}
+	return layouts;
+}
+
+void bench_generate_squids(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	std::vector<squid_layout> layouts(BENCH_CALLS);
+
+	while (s.keep_running())
+	{
+		for (auto &layout : layouts)
+		{
+			generate_squids(rng, layout);
+		}
+		bench::do_not_optimize(layouts[0]);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "layouts");
+}
+BENCHMARK(bench_generate_squids);
+
+void bench_start_pattern(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+
+	while (s.keep_running())
+	{
+		square_mask bits = 0;
+		for (u32 i = 0; i < BENCH_CALLS; ++i)
+		{
+			bits ^= bench_pattern(rng).get_mask();
+		}
+		bench::do_not_optimize(bits);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "patterns");
+}
+BENCHMARK(bench_start_pattern);
+
+void bench_mutate_pattern(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	bench_pattern pattern(rng);
+
+	while (s.keep_running())
+	{
+		for (u32 i = 0; i < BENCH_CALLS; ++i)
+		{
+			pattern.mutate(rng);
+		}
+		bench::do_not_optimize(pattern);
+	}
+
+	s.set_items_per_iteration(BENCH_CALLS, "patterns");
+}
+BENCHMARK(bench_mutate_pattern);
+
+/* Rate BENCH_CANDIDATES patterns on BENCH_LAYOUTS layouts with one goal */
+template<typename Goal>
+void bench_goal(bench::state &s, Goal goal)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts(rng, BENCH_LAYOUTS);
+
+	std::vector<bench_pattern> candidates;
+	for (u32 i = 0; i < BENCH_CANDIDATES; ++i)
+	{
+		candidates.emplace_back(rng);
+	}
+
+	while (s.keep_running())
+	{
+		double total = 0;
+		for (const auto &candidate : candidates)
+		{
+			for (const auto &layout : layouts)
+			{
+				total += goal(candidate, layout);
+			}
+		}
+		bench::do_not_optimize(total);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(BENCH_CANDIDATES) * BENCH_LAYOUTS, "candidate*layouts");
+}
+
+void bench_goal_at_least_1(bench::state &s)
+{
+	bench_goal(s, optimization_goal::at_least_1<BENCH_PATTERN_SIZE>);
+}
+BENCHMARK(bench_goal_at_least_1);
+
+void bench_goal_fast_hit(bench::state &s)
+{
+	bench_goal(s, optimization_goal::fast_hit<BENCH_PATTERN_SIZE>);
+}
+BENCHMARK(bench_goal_fast_hit);
+
+/* One GA round's racing evaluation, scaled down */
+void bench_race_round(bench::state &s)
+{
+	std::mt19937 rng(s.seed());
+	auto layouts = bench_random_layouts(rng, BENCH_LAYOUTS);
+
+	std::vector<std::pair<double, bench_pattern> > population;
+	for (u32 i = 0; i < 1024; ++i)
+	{
+		population.emplace_back(0, bench_pattern(rng));
+	}
+
+	racing::options race_options;
+	std::vector<racing::bounds> bounds;
+	u64 evaluations = 0;
+
+	while (s.keep_running())
+	{
+		auto candidates = population;
+		evaluations = racing::race(candidates, candidates.size() / 2, layouts, optimization_goal::fast_hit<BENCH_PATTERN_SIZE>,
+								   race_options, bounds);
+	}
+
+	s.set_items_per_iteration(static_cast<double>(evaluations), "candidate*layouts");
+}
+BENCHMARK(bench_race_round);
+
+int main(int argc, char **argv)
+{
+	return bench::main(argc, argv);
+}
+#endif
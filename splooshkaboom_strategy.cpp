@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -6,13 +7,35 @@
 #include <random>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <memory>
+#include <mutex>
 
 extern "C"
 {
 #include <x86intrin.h>
 }
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "server.h"
+#include "streams.h"
+
 using std::cout;
 using std::endl;
 
@@ -180,7 +203,7 @@ std::vector<squid_layout> generate_all_possible_squid_layouts()
 	cout << "Maximum layout probability: " << max << endl;
 #endif
 
-	return std::move(layouts);
+	return layouts;
 }
 
 struct partial_solution
@@ -190,9 +213,15 @@ struct partial_solution
 	u32 squids_found = 0u;
 };
 
+/* Squares not shot yet */
+u32 unshot_squares(const partial_solution &partial)
+{
+	return 64 - static_cast<u32>(__builtin_popcountll(partial.shot_locations));
+}
+
 bool layout_matches_partial(const squid_layout &layout, const partial_solution &partial)
 {
-	assert(~partial.shot_locations & partial.revealed_squids == 0u);
+	assert((~partial.shot_locations & partial.revealed_squids) == 0u);
 
 	if (((~partial.shot_locations & layout.combined) | (partial.revealed_squids)) != layout.combined)
 	{
@@ -219,359 +248,3558 @@ bool layout_matches_partial(const squid_layout &layout, const partial_solution &
 	return found == partial.squids_found;
 }
 
-template<u32 N>
-struct game
+/*
+ * Bitsets over layout ids for filtering the layout table. Bit i of
+ * occupied[s] is set if layout i has a squid on square s, and bit i of a
+ * placement's row is set if layout i puts that squid size exactly there.
+ * Filtering by a partial solution then only takes one AND per shot plus a
+ * few ORs for the squids that could be complete.
+ */
+class layout_index
 {
-	u8 packed_shots[N] = {0};
-	double weight = 0;
+	static constexpr u32 BLOCK_WORDS = 64;
 
-public:
+	/* Placements of a squid on the board: 2 * 8 * (9 - length) at most,
+	 * 112 for the length 2 squid */
+	static constexpr u32 MAX_PLACEMENTS = 2 * 8 * 7;
 
-	void set_weight(double w)
-	{
-		weight = w;
-	}
+	const std::vector<squid_layout> &table;
+	u32 n_words;
 
-	double get_weight() const
-	{
-		return weight;
-	}
+	std::vector<u64> occupied;
+	std::vector<square_mask> placements[5];
+	std::vector<u64> placed[5];
 
-	u8 get_raw(u32 index)
+	/* Probability of every layout in units of 2^-60, packed for
+	 * miss_weight: integer sums are exact and don't wait on the latency
+	 * of a floating point add per layout */
+	static constexpr double WEIGHT_ONE = 1152921504606846976.0;
+	std::vector<u64> weights;
+
+	static void set_bit(std::vector<u64> &rows, u32 row, u32 words, u32 id)
 	{
-		return packed_shots[index];
+		rows[row * words + id / 64] |= 1ull << (id % 64);
 	}
 
-	void set_shot(u32 index, u8 position, bool hit, bool sank_squid)
+	template<typename F>
+	void for_each_placement(F &&fn) const
 	{
-		assert(index < N);
-		assert(position < 64);
-		packed_shots[index] = static_cast<u8>((position << 2u) | (hit ? 2u : 0u) | (sank_squid ? 1u : 0u));
+		for (u32 size = 2; size <= 4; ++size)
+		{
+			for (u32 p = 0; p < placements[size].size(); ++p)
+			{
+				fn(size, placements[size][p], &placed[size][p * n_words]);
+			}
+		}
 	}
 
-	void get(u32 index, u32 &pos, bool &is_hit, bool &sank_squid) const
+public:
+
+	explicit layout_index(const std::vector<squid_layout> &layouts)
+		: table(layouts), n_words(static_cast<u32>((layouts.size() + 63) / 64))
 	{
-		assert(index < N);
+		occupied.assign(64 * n_words, 0);
+
+		for (const auto &layout : layouts)
+		{
+			weights.push_back(static_cast<u64>(std::llround(layout.probability * WEIGHT_ONE)));
+			placements[2].push_back(layout.squid2);
+			placements[3].push_back(layout.squid3);
+			placements[4].push_back(layout.squid4);
+		}
+
+		for (u32 size = 2; size <= 4; ++size)
+		{
+			auto &list = placements[size];
+			std::sort(list.begin(), list.end());
+			list.erase(std::unique(list.begin(), list.end()), list.end());
+			assert(list.size() <= MAX_PLACEMENTS);
+			placed[size].assign(list.size() * n_words, 0);
+		}
 
-		pos = packed_shots[index] >> 2;
-		is_hit = (packed_shots[index] & 2u) != 0;
-		sank_squid = (packed_shots[index] & 1u) != 0;
+		auto placement_of = [this] (u32 size, square_mask squid)
+		{
+			auto &list = placements[size];
+			return static_cast<u32>(std::lower_bound(list.begin(), list.end(), squid) - list.begin());
+		};
+
+		for (u32 id = 0; id < layouts.size(); ++id)
+		{
+			const squid_layout &layout = layouts[id];
+
+			square_mask combined = layout.combined;
+			while (combined)
+			{
+				set_bit(occupied, __builtin_ctzll(combined), n_words, id);
+				combined &= combined - 1;
+			}
+
+			set_bit(placed[2], placement_of(2, layout.squid2), n_words, id);
+			set_bit(placed[3], placement_of(3, layout.squid3), n_words, id);
+			set_bit(placed[4], placement_of(4, layout.squid4), n_words, id);
+		}
 	}
 
-	u32 get_pos(u32 index) const
+	const std::vector<squid_layout> &layouts() const
 	{
-		assert(index < N);
-		return packed_shots[index] >> 2;
+		return table;
 	}
 
-	bool is_hit(u32 index) const
+	u32 size() const
 	{
-		assert(index < N);
-		return (packed_shots[index] & 2u) != 0;
+		return static_cast<u32>(table.size());
 	}
 
-	bool is_sank_squid(u32 index) const
+	u32 words() const
 	{
-		return (packed_shots[index] & 1u) != 0;
+		return n_words;
 	}
 
-	bool operator== (const game<N> &other) const
+	/* Bitset of all layouts */
+	void fill(u64 *out) const
 	{
-		return std::memcmp(packed_shots, other.packed_shots, sizeof(packed_shots)) == 0 && weight == other.weight;
+		std::fill(out, out + n_words, ~0ull);
+		if (table.size() % 64)
+		{
+			out[n_words - 1] = (1ull << (table.size() % 64)) - 1;
+		}
 	}
 
-	bool operator< (const game<N> &other) const
+	/* Bitset of the layouts matching partial. Same result as running
+	 * layout_matches_partial on every layout. */
+	void filter(const partial_solution &partial, u64 *out) const
 	{
-		int cmp = std::memcmp(packed_shots, other.packed_shots, sizeof(packed_shots));
-		return cmp < 0 || (cmp == 0 && weight < other.weight);
+		assert((~partial.shot_locations & partial.revealed_squids) == 0u);
+
+		/* Rows to AND in, flipped for misses */
+		const u64 *rows[64];
+		u64 flips[64];
+		u32 n_rows = 0;
+
+		square_mask shots = partial.shot_locations;
+		while (shots)
+		{
+			u32 square = __builtin_ctzll(shots);
+			shots &= shots - 1;
+
+			rows[n_rows] = &occupied[square * n_words];
+			flips[n_rows] = (partial.revealed_squids & (1ull << square)) ? 0ull : ~0ull;
+			n_rows++;
+		}
+
+		/* Placements that are completely revealed, per squid. All of them
+		 * for a state with every square revealed, which the fleet cannot
+		 * make but a caller may ask about. */
+		const u64 *complete[5][MAX_PLACEMENTS];
+		u32 n_complete[5] = {0};
+
+		for_each_placement([&] (u32 size, square_mask squid, const u64 *row)
+		{
+			if ((partial.revealed_squids & squid) == squid)
+			{
+				complete[size][n_complete[size]++] = row;
+			}
+		});
+
+		fill(out);
+
+		for (u32 block = 0; block < n_words; block += BLOCK_WORDS)
+		{
+			const u32 block_end = std::min(n_words, block + BLOCK_WORDS);
+
+			for (u32 r = 0; r < n_rows; ++r)
+			{
+				const u64 *row = rows[r];
+				const u64 flip = flips[r];
+
+				for (u32 w = block; w < block_end; ++w)
+				{
+					out[w] &= row[w] ^ flip;
+				}
+			}
+
+			for (u32 w = block; w < block_end; ++w)
+			{
+				u64 found[5] = {0};
+				for (u32 size = 2; size <= 4; ++size)
+				{
+					for (u32 c = 0; c < n_complete[size]; ++c)
+					{
+						found[size] |= complete[size][c][w];
+					}
+				}
+
+				const u64 any = found[2] | found[3] | found[4];
+				const u64 odd = found[2] ^ found[3] ^ found[4];
+				const u64 at_least_2 = (found[2] & found[3]) | (found[2] & found[4]) | (found[3] & found[4]);
+				const u64 all = found[2] & found[3] & found[4];
+
+				u64 count_matches = 0;
+				switch (partial.squids_found)
+				{
+				case 0: count_matches = ~any; break;
+				case 1: count_matches = odd & ~at_least_2; break;
+				case 2: count_matches = at_least_2 & ~all; break;
+				case 3: count_matches = all; break;
+				}
+
+				out[w] &= count_matches;
+			}
+		}
 	}
 
-	void print () const
+	/* Narrow a bitset of layouts matching partial down to those that agree
+	 * with one more shot at pos. Unlike filter(), this also takes into
+	 * account whether this particular shot sank a squid. */
+	void filter_shot(const partial_solution &partial, u32 pos, bool hit, bool sank_squid, u64 *bits) const
 	{
-		for (u32 i = 0; i < N; ++i)
+		const square_mask pos_mask = 1ull << pos;
+		const u64 *row = &occupied[pos * n_words];
+		const u64 flip = hit ? 0ull : ~0ull;
+
+		if (!hit && sank_squid)
 		{
-			u32 pos;
-			bool is_hit, sank_squid;
+			std::fill(bits, bits + n_words, 0ull);
+			return;
+		}
 
-			get(i, pos, is_hit, sank_squid);
+		/* Placements this shot would complete */
+		const u64 *sunk[64 * 3];
+		u32 n_sunk = 0;
+
+		if (hit)
+		{
+			const square_mask hits = partial.revealed_squids | pos_mask;
+			for_each_placement([&] (u32, square_mask squid, const u64 *placement_row)
+			{
+				if ((squid & pos_mask) && (hits & squid) == squid)
+				{
+					sunk[n_sunk++] = placement_row;
+				}
+			});
+		}
 
-			cout << pos;
+		const u64 sunk_flip = sank_squid ? 0ull : ~0ull;
 
-			if (is_hit)
+		for (u32 w = 0; w < n_words; ++w)
+		{
+			u64 sinks = 0;
+			for (u32 i = 0; i < n_sunk; ++i)
 			{
-				cout << 'h';
+				sinks |= sunk[i][w];
+			}
+
+			bits[w] &= (row[w] ^ flip) & (sinks ^ sunk_flip);
+		}
+	}
+
+	/* Probability mass of the layouts in bits without a squid on any
+	 * square of pattern (all of them for an empty pattern) */
+	double miss_weight(const u64 *bits, square_mask pattern) const
+	{
+		const u64 *rows[64];
+		u32 n_rows = 0;
+		while (pattern)
+		{
+			rows[n_rows++] = &occupied[__builtin_ctzll(pattern) * n_words];
+			pattern &= pattern - 1;
+		}
+
+		u64 weight = 0;
+		for (u32 w = 0; w < n_words; ++w)
+		{
+			u64 missed = bits[w];
+			for (u32 r = 0; r < n_rows; ++r)
+			{
+				missed &= ~rows[r][w];
 			}
 
-			if (sank_squid)
+			while (missed)
 			{
-				cout << '!';
+				weight += weights[w * 64 + __builtin_ctzll(missed)];
+				missed &= missed - 1;
+			}
+		}
+		return weight / WEIGHT_ONE;
+	}
+
+	static bool test(const u64 *bits, u32 id)
+	{
+		return (bits[id / 64] >> (id % 64)) & 1u;
+	}
+
+	/* Write the ids of all set bits to ids */
+	void extract(const u64 *bits, std::vector<u32> &ids) const
+	{
+		ids.clear();
+
+		for (u32 w = 0; w < n_words; ++w)
+		{
+			u64 word = bits[w];
+			while (word)
+			{
+				ids.push_back(w * 64 + __builtin_ctzll(word));
+				word &= word - 1;
 			}
-			cout << ' ';
 		}
+	}
+};
+
+/* Indices into the shared layout table that survive a partial solution */
+struct layout_view
+{
+	const squid_layout *table = nullptr;
+	const u32 *ids = nullptr;
+	u32 count = 0;
+
+	u32 size() const
+	{
+		return count;
+	}
 
-		cout << ": " << weight << endl;
+	const squid_layout &operator[](u32 index) const
+	{
+		assert(index < count);
+		return table[ids[index]];
 	}
 };
 
-template<u32 N>
-void gen_random_game (const std::vector<squid_layout> &layouts, const partial_solution &partial, game<N> &g, std::mt19937 &rng)
+/* Write the indices of all layouts matching partial into ids. The buffers
+ * keep their capacity, so this does not allocate once they have grown. */
+layout_view filter_layouts(const layout_index &index, const partial_solution &partial, std::vector<u64> &bits, std::vector<u32> &ids)
 {
-	/* Pick a random layout */
-	const squid_layout layout = layouts[randint(rng, layouts.size()-1)];
+	PROFILE_SCOPE("filter_layouts");
 
-	/* Generate a random game that finds this layout */
-	u8 positions[N];
-	u32 positions_set = 0;
+	bits.resize(index.words());
+	index.filter(partial, bits.data());
 
-	/* Fill start position array with hits */
-	square_mask not_found = layout.combined & ~partial.revealed_squids;
+	ids.reserve(index.size());
+	index.extract(bits.data(), ids);
 
-	while (not_found)
+#if !NDEBUG
+	for (u32 i = 0; i < index.size(); ++i)
 	{
-		u32 pos = __builtin_ctzll(not_found);
-		not_found &= ~(1ull << pos);
-
-		positions[positions_set++] = static_cast<u8>(pos);
+		assert(layout_index::test(bits.data(), i) == layout_matches_partial(index.layouts()[i], partial));
 	}
+#endif
 
-	/* Fill up rest with arbitrary misses */
-	not_found = ~(layout.combined | partial.shot_locations);
-	while (positions_set < N)
+	return layout_view{index.layouts().data(), ids.data(), static_cast<u32>(ids.size())};
+}
+
+/*
+ * Bump allocator for per-query scratch memory. Allocation is a single
+ * atomic add, so worker threads can allocate concurrently. Memory is only
+ * returned by reset(), which also merges all chunks used during the last
+ * query into one, so repeated queries of the same size stop hitting the
+ * heap after the first one.
+ */
+class arena
+{
+	struct chunk
 	{
-		u32 pos = __builtin_ctzll(_pdep_u64(1ull << randint(rng, __builtin_popcountll(not_found) - 1), not_found));
-		not_found &= ~(1ull << pos);
+		std::unique_ptr<u8[]> data;
+		size_t capacity = 0;
+		std::atomic<size_t> used{0};
+	};
 
-		positions[positions_set++] = static_cast<u8>(pos);
-	}
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr size_t MIN_CHUNK = 1 << 20;
 
-	/* Shuffle array */
-	std::shuffle(&positions[0], &positions[N], rng);
+	std::vector<std::unique_ptr<chunk>> chunks;
+	std::atomic<chunk *> current{nullptr};
+	std::mutex grow_mutex;
 
+	static u8 *aligned_base(const chunk &c)
+	{
+		uintptr_t p = reinterpret_cast<uintptr_t>(c.data.get());
+		return reinterpret_cast<u8 *>((p + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+	}
 
-	/* Fill in positions along with game metadata */
-	square_mask shots = partial.shot_locations;
-	for (u32 i = 0; i < N; ++i)
+	void add_chunk(size_t capacity)
 	{
-		u8 pos = positions[i];
-		square_mask pos_mask = 1ull << pos;
+		auto c = std::make_unique<chunk>();
+		c->data.reset(new u8[capacity + ALIGNMENT]);
+		c->capacity = capacity;
+		current.store(c.get(), std::memory_order_release);
+		chunks.push_back(std::move(c));
+	}
 
-		shots |= pos_mask;
+public:
 
-		bool is_hit = (layout.combined & pos_mask) != 0;
-		bool sank_squid = false;
+	void *allocate(size_t bytes)
+	{
+		bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 
-		if (is_hit)
+		while (1)
 		{
-			if ((layout.squid2 & pos_mask) != 0 && (layout.squid2 & shots) == layout.squid2)
-			{
-				sank_squid = true;
-			}
-			else if ((layout.squid3 & pos_mask) != 0 && (layout.squid3 & shots) == layout.squid3)
+			chunk *c = current.load(std::memory_order_acquire);
+
+			if (c)
 			{
-				sank_squid = true;
+				size_t offset = c->used.fetch_add(bytes, std::memory_order_relaxed);
+				if (offset + bytes <= c->capacity)
+				{
+					return aligned_base(*c) + offset;
+				}
 			}
-			else if ((layout.squid4 & pos_mask) != 0 && (layout.squid4 & shots) == layout.squid4)
+
+			std::lock_guard<std::mutex> lock(grow_mutex);
+			if (current.load(std::memory_order_relaxed) == c)
 			{
-				sank_squid = true;
+				add_chunk(std::max({bytes, MIN_CHUNK, c ? 2 * c->capacity : 0}));
 			}
 		}
-
-		g.set_shot(i, pos, is_hit, sank_squid);
 	}
 
-	g.set_weight(layout.probability);
-}
-
-template<u32 N>
-double calc_score(u32 level, typename std::vector<game<N> >::iterator &it, const typename std::vector<game<N>>::iterator &end)
-{
-	if (level == N)
+	template<typename T>
+	T *alloc(size_t count)
 	{
-		double score = it->get_weight();
-		it++;
-		return score;
+		T *p = static_cast<T *>(allocate(count * sizeof(T)));
+		std::uninitialized_default_construct_n(p, count);
+		return p;
 	}
 
-	auto start = it;
+	/* Release everything. Not thread safe */
+	void reset()
+	{
+		if (chunks.size() > 1)
+		{
+			size_t total = 0;
+			for (auto &c : chunks)
+			{
+				total += c->capacity;
+			}
+
+			chunks.clear();
+			add_chunk(total);
+		}
+		else if (!chunks.empty())
+		{
+			chunks[0]->used.store(0, std::memory_order_relaxed);
+		}
+	}
+};
 
-	double best_miss = 0.0;
-	double best_hit = 0.0;
-	double best_sink = 0.0;
+/* Buffers reused across find_best_position calls */
+struct solver_workspace
+{
+	arena scratch;
+	std::vector<u64> layout_bits;
+	std::vector<u32> layout_ids;
+};
 
-	while(1) {
-		bool is_hit = it->is_hit(level);
-		bool sank_squid = it->is_sank_squid(level);
+/*
+ * Exact posterior probability of every square holding a squid, overall and
+ * per squid length, given the layouts that survive a partial solution.
+ */
+struct square_heatmap
+{
+	double occupied[64] = {0.0};
+	double squid[5][64] = {{0.0}};
 
-		double score = calc_score<N>(level+1, it, end);
+	/* Prior probability mass of the surviving layouts */
+	double total_weight = 0.0;
+	u32 layouts = 0;
 
-		if (sank_squid)
-		{
-			best_sink = std::max(score, best_sink);
-		}
-		else if (is_hit)
+	void add(const square_heatmap &other)
+	{
+		for (u32 pos = 0; pos < 64; ++pos)
 		{
-			best_hit = std::max(score, best_hit);
+			occupied[pos] += other.occupied[pos];
+			squid[2][pos] += other.squid[2][pos];
+			squid[3][pos] += other.squid[3][pos];
+			squid[4][pos] += other.squid[4][pos];
 		}
-		else
+
+		total_weight += other.total_weight;
+		layouts += other.layouts;
+	}
+
+	/* Turn accumulated weights into probabilities */
+	void normalize()
+	{
+		if (total_weight <= 0.0)
 		{
-			best_miss = std::max(score, best_miss);
+			return;
 		}
 
-		if (it == end)
+		const double scale = 1.0 / total_weight;
+		for (u32 pos = 0; pos < 64; ++pos)
 		{
-			break;
+			occupied[pos] *= scale;
+			squid[2][pos] *= scale;
+			squid[3][pos] *= scale;
+			squid[4][pos] *= scale;
 		}
+	}
+
+	/* Square outside of exclude with the highest probability */
+	u32 most_likely(square_mask exclude) const
+	{
+		u32 best = ~0u;
+		double best_probability = -1.0;
 
-		bool keep_going = true;
-		for (u32 i = 0; i < level; ++i)
+		for (u32 pos = 0; pos < 64; ++pos)
 		{
-			if (start->get_raw(i) != it->get_raw(i))
+			if (!(exclude & (1ull << pos)) && occupied[pos] > best_probability)
 			{
-				keep_going = false;
-				break;
+				best = pos;
+				best_probability = occupied[pos];
 			}
 		}
 
-		if (start->get_pos(level) != it->get_pos(level))
+		return best;
+	}
+
+	void print() const
+	{
+		cout << "\n+";
+		for (u32 x = 0; x < WIDTH; ++x)
 		{
-			keep_going = false;
+			cout << "------+";
 		}
+		cout << endl;
 
-		if (!keep_going)
+		for (u32 y = 0; y < WIDTH; ++y)
 		{
-			break;
+			cout << "|";
+			for (u32 x = 0; x < WIDTH; ++x)
+			{
+				cout << std::setw(5) << std::fixed << std::setprecision(1)
+					 << 100.0 * occupied[square_offset(x, y)] << " |";
+			}
+			cout << endl;
+
+			cout << "+";
+			for (u32 x = 0; x < WIDTH; ++x)
+			{
+				cout << "------+";
+			}
+			cout << endl;
 		}
 
+		cout.unsetf(std::ios::floatfield);
+		cout << std::setprecision(6);
 	}
+};
 
-	return best_miss + best_hit + best_sink;
+void accumulate_squid(square_mask squid, double weight, double (&squares)[64])
+{
+	while (squid)
+	{
+		squares[__builtin_ctzll(squid)] += weight;
+		squid &= squid - 1;
+	}
 }
 
-template<u32 N>
-std::pair<u32,u32> find_best_position(std::vector<squid_layout> &layouts, const partial_solution &partial, const u32 n_samples, std::mt19937 &rng)
+/* One weighted pass over the layouts. Blocks are summed into their own
+ * heatmaps and reduced in order, so the result does not depend on the
+ * number of threads. */
+void compute_heatmap(const layout_view &layouts, square_heatmap &heatmap, arena &scratch)
 {
-	/* Remove layouts that don't match partial solution in advance */
-	layouts.erase(std::remove_if(layouts.begin(), layouts.end(),
-								 [&] (const squid_layout &layout) { return !layout_matches_partial(layout, partial); }),
-				  layouts.end());
+	PROFILE_SCOPE("compute_heatmap");
 
-	/* Randomly sample possible winning games */
-	std::vector<game<N>> games;
-	for (u32 i = 0; i < n_samples; ++i)
+	const u32 HEATMAP_BLOCK = 16384;
+	const u32 n_blocks = (layouts.size() + HEATMAP_BLOCK - 1) / HEATMAP_BLOCK;
+
+	square_heatmap *partials = scratch.alloc<square_heatmap>(n_blocks);
+
+	scheduler::parallel_for(0, n_blocks, 1, [&] (size_t begin, size_t end)
 	{
-		auto &new_game = games.emplace_back();
+		for (size_t block = begin; block < end; ++block)
+		{
+			square_heatmap &part = partials[block];
 
-		gen_random_game(layouts, partial, new_game, rng);
-	}
+			u32 last = std::min<u32>(layouts.size(), (block + 1) * HEATMAP_BLOCK);
+			for (u32 i = block * HEATMAP_BLOCK; i < last; ++i)
+			{
+				const squid_layout &layout = layouts[i];
 
-	/* Sort games */
-	std::sort(games.begin(), games.end());
+				accumulate_squid(layout.squid2, layout.probability, part.squid[2]);
+				accumulate_squid(layout.squid3, layout.probability, part.squid[3]);
+				accumulate_squid(layout.squid4, layout.probability, part.squid[4]);
+				part.total_weight += layout.probability;
+			}
 
-	/* Find best opening */
-	u32 best = ~0;
-	double best_score = -1.0f;
+			part.layouts = last - block * HEATMAP_BLOCK;
+
+			for (u32 pos = 0; pos < 64; ++pos)
+			{
+				part.occupied[pos] = part.squid[2][pos] + part.squid[3][pos] + part.squid[4][pos];
+			}
+		}
+	});
 
-	typename std::vector<game<N>>::iterator it = games.begin();
-	while (it != games.end())
+	heatmap = square_heatmap();
+	for (u32 block = 0; block < n_blocks; ++block)
 	{
-		u32 pos = it->get_pos(0);
-		double score = calc_score<N>(0, it, games.end());
+		heatmap.add(partials[block]);
+	}
+
+	heatmap.normalize();
+}
 
-		if (score > best_score)
+/* Chance of each of n patterns hitting a squid, given the layouts in bits
+ * (as filled in by filter_layouts) and their probability mass total. A
+ * pattern misses the layouts without a squid on any of its squares, which
+ * are a few ANDs of the index's rows per word away, and only those are
+ * summed up. The patterns are rated in parallel. */
+void rate_patterns(const layout_index &index, const u64 *bits, double total, const square_mask *patterns, u32 n, double *hit)
+{
+	PROFILE_SCOPE("rate_patterns");
+
+	scheduler::parallel_for(0, n, 1, [&] (size_t begin, size_t end)
+	{
+		for (size_t p = begin; p < end; ++p)
 		{
-			best = pos;
-			best_score = score;
+			hit[p] = total > 0.0 ? (total - index.miss_weight(bits, patterns[p])) / total : 0.0;
 		}
-	}
-
-	cout << best_score << endl;
-	return std::pair<u32,u32>(best % 8, best / 8);
+	});
 }
 
+/* The same, summing up the total first */
+void rate_patterns(const layout_index &index, const u64 *bits, const square_mask *patterns, u32 n, double *hit)
+{
+	rate_patterns(index, bits, index.miss_weight(bits, 0), patterns, n, hit);
+}
 
-std::pair<u32,u32> find_best_position(u32 max_levels, std::vector<squid_layout> &layouts, const partial_solution &partial, const u32 n_samples, std::mt19937 &rng)
+square_heatmap posterior_heatmap(const layout_index &index, const partial_solution &partial, solver_workspace &workspace)
 {
-	switch (max_levels)
-	{
-	case 1:
-		return find_best_position<1>(layouts, partial, n_samples, rng);
-	case 2:
-		return find_best_position<2>(layouts, partial, n_samples, rng);
-	case 3:
-		return find_best_position<3>(layouts, partial, n_samples, rng);
-	case 4:
-		return find_best_position<4>(layouts, partial, n_samples, rng);
-	case 5:
-		return find_best_position<5>(layouts, partial, n_samples, rng);
-	case 6:
-		return find_best_position<6>(layouts, partial, n_samples, rng);
-	case 7:
-		return find_best_position<7>(layouts, partial, n_samples, rng);
-	case 8:
-		return find_best_position<8>(layouts, partial, n_samples, rng);
-	case 9:
-		return find_best_position<9>(layouts, partial, n_samples, rng);
-	case 10:
-		return find_best_position<10>(layouts, partial, n_samples, rng);
-	case 11:
-		return find_best_position<11>(layouts, partial, n_samples, rng);
-	case 12:
-		return find_best_position<12>(layouts, partial, n_samples, rng);
-	case 13:
-		return find_best_position<13>(layouts, partial, n_samples, rng);
-	case 14:
-		return find_best_position<14>(layouts, partial, n_samples, rng);
-	case 15:
-		return find_best_position<15>(layouts, partial, n_samples, rng);
-	case 16:
-		return find_best_position<16>(layouts, partial, n_samples, rng);
-	case 17:
-		return find_best_position<17>(layouts, partial, n_samples, rng);
-	case 18:
-		return find_best_position<18>(layouts, partial, n_samples, rng);
-	case 19:
-		return find_best_position<19>(layouts, partial, n_samples, rng);
-	case 20:
-		return find_best_position<20>(layouts, partial, n_samples, rng);
-	case 21:
-		return find_best_position<21>(layouts, partial, n_samples, rng);
-	case 22:
-		return find_best_position<22>(layouts, partial, n_samples, rng);
-	case 23:
-		return find_best_position<23>(layouts, partial, n_samples, rng);
-	case 24:
-		return find_best_position<24>(layouts, partial, n_samples, rng);
-	case 25:
-		return find_best_position<25>(layouts, partial, n_samples, rng);
-	case 26:
-		return find_best_position<26>(layouts, partial, n_samples, rng);
-	case 27:
-		return find_best_position<27>(layouts, partial, n_samples, rng);
-	case 28:
-		return find_best_position<28>(layouts, partial, n_samples, rng);
-	case 29:
-		return find_best_position<29>(layouts, partial, n_samples, rng);
-	default:
-		assert(0);
-	}
+	workspace.scratch.reset();
+
+	layout_view layouts = filter_layouts(index, partial, workspace.layout_bits, workspace.layout_ids);
+
+	square_heatmap heatmap;
+	compute_heatmap(layouts, heatmap, workspace.scratch);
+
+	return heatmap;
+}
 
-	return std::pair<u32,u32>(0,0);
+/* Greedy policy: shoot the square most likely to hold a squid */
+u32 greedy_shot(const layout_index &index, const partial_solution &partial, solver_workspace &workspace)
+{
+	return posterior_heatmap(index, partial, workspace).most_likely(partial.shot_locations);
 }
 
+/*
+ * A set of sampled games searched to a runtime depth. Every game is one row
+ * of depth packed shots, (position << 2) | (hit << 1) | sank_squid, in a
+ * single flat buffer. Rows are padded with zeros to a multiple of 8 bytes,
+ * so they can be compared a 64 bit word at a time, and the kernels below are
+ * specialized for the common row strides with a generic fallback.
+ */
+const u32 MAX_DEPTH = 64;
 
-int main()
+struct game_set
 {
-	std::random_device dev;
-	std::mt19937 rng(dev());
+	u32 depth = 0;
+	u32 stride = 0;
+	u32 count = 0;
 
-	std::vector<std::pair<double, square_mask> > candidates;
+	u8 *shots = nullptr;
+	double *weights = nullptr;
 
-	auto all_layouts = generate_all_possible_squid_layouts();
+	/* Index of the sampled layout in the full layout table */
+	u32 *layout_ids = nullptr;
 
-	partial_solution partial = {};
+	static u32 stride_for(u32 depth)
+	{
+		return (depth + 7) & ~7u;
+	}
+
+	u8 *row(u32 game) const
+	{
+		return shots + static_cast<size_t>(game) * stride;
+	}
 
-	auto pos = find_best_position(18, all_layouts, partial, 100000, rng);
+	u8 get_raw(u32 game, u32 index) const
+	{
+		assert(index < depth);
+		return row(game)[index];
+	}
 
-	cout << pos.first << " " << pos.second << endl;
+	u32 get_pos(u32 game, u32 index) const
+	{
+		return get_raw(game, index) >> 2;
+	}
 
-}
+	bool is_hit(u32 game, u32 index) const
+	{
+		return (get_raw(game, index) & 2u) != 0;
+	}
+
+	bool is_sank_squid(u32 game, u32 index) const
+	{
+		return (get_raw(game, index) & 1u) != 0;
+	}
+
+	void set_shot(u32 game, u32 index, u8 position, bool hit, bool sank_squid)
+	{
+		assert(index < depth);
+		assert(position < 64);
+		row(game)[index] = static_cast<u8>((position << 2u) | (hit ? 2u : 0u) | (sank_squid ? 1u : 0u));
+	}
+
+	void print(u32 game) const
+	{
+		for (u32 i = 0; i < depth; ++i)
+		{
+			cout << get_pos(game, i);
+
+			if (is_hit(game, i))
+			{
+				cout << 'h';
+			}
+
+			if (is_sank_squid(game, i))
+			{
+				cout << '!';
+			}
+			cout << ' ';
+		}
+
+		cout << ": " << weights[game] << endl;
+	}
+};
+
+game_set alloc_games(u32 depth, u32 count, arena &scratch)
+{
+	assert(depth <= MAX_DEPTH);
+
+	game_set games;
+	games.depth = depth;
+	games.stride = game_set::stride_for(depth);
+	games.count = count;
+	games.shots = scratch.alloc<u8>(static_cast<size_t>(count) * games.stride);
+	games.weights = scratch.alloc<double>(count);
+	games.layout_ids = scratch.alloc<u32>(count);
+
+	return games;
+}
+
+/* Fill in hit/sink flags for a game shooting positions on layout */
+void fill_game(const squid_layout &layout, const partial_solution &partial, const u8 *positions, game_set &games, u32 game)
+{
+	square_mask shots = partial.shot_locations;
+	for (u32 i = 0; i < games.depth; ++i)
+	{
+		u8 pos = positions[i];
+		square_mask pos_mask = 1ull << pos;
+
+		shots |= pos_mask;
+
+		bool is_hit = (layout.combined & pos_mask) != 0;
+		bool sank_squid = false;
+
+		if (is_hit)
+		{
+			if ((layout.squid2 & pos_mask) != 0 && (layout.squid2 & shots) == layout.squid2)
+			{
+				sank_squid = true;
+			}
+			else if ((layout.squid3 & pos_mask) != 0 && (layout.squid3 & shots) == layout.squid3)
+			{
+				sank_squid = true;
+			}
+			else if ((layout.squid4 & pos_mask) != 0 && (layout.squid4 & shots) == layout.squid4)
+			{
+				sank_squid = true;
+			}
+		}
+
+		games.set_shot(game, i, pos, is_hit, sank_squid);
+	}
+
+	std::memset(games.row(game) + games.depth, 0, games.stride - games.depth);
+	games.weights[game] = layout.probability;
+}
+
+/*
+ * Random order of depth shots that finds layout: its unfound squid squares
+ * and random misses, shuffled. Needs at least depth unshot squares. With
+ * fewer shots than unfound squid squares the order is cut short after depth
+ * shots. Returns the number of positions written.
+ */
+u32 random_shot_order(const squid_layout &layout, const partial_solution &partial, u32 depth, u8 *positions, std::mt19937 &rng)
+{
+	u32 positions_set = 0;
+
+	/* Fill start position array with hits */
+	square_mask not_found = layout.combined & ~partial.revealed_squids;
+
+	while (not_found)
+	{
+		u32 pos = __builtin_ctzll(not_found);
+		not_found &= ~(1ull << pos);
+
+		positions[positions_set++] = static_cast<u8>(pos);
+	}
+
+	/* Fill up rest with arbitrary misses */
+	not_found = ~(layout.combined | partial.shot_locations);
+	while (positions_set < depth)
+	{
+		u32 pos = __builtin_ctzll(bits::select_bit(randint(rng, __builtin_popcountll(not_found) - 1), not_found));
+		not_found &= ~(1ull << pos);
+
+		positions[positions_set++] = static_cast<u8>(pos);
+	}
+
+	/* Shuffle array */
+	std::shuffle(&positions[0], &positions[positions_set], rng);
+
+	return positions_set;
+}
+
+void gen_random_game (const layout_view &layouts, const partial_solution &partial, game_set &games, u32 game, std::mt19937 &rng)
+{
+	/* Pick a random layout */
+	const u32 index = randint(rng, layouts.size()-1);
+	const squid_layout layout = layouts[index];
+
+	/* Generate a random game that finds this layout */
+	u8 positions[MAX_DEPTH];
+	random_shot_order(layout, partial, games.depth, positions, rng);
+
+	/* Fill in positions along with game metadata */
+	fill_game(layout, partial, positions, games, game);
+	games.layout_ids[game] = layouts.ids[index];
+}
+
+/*
+ * Turn a game sampled before the shot at shot_pos into one sampled after it.
+ * partial must already include the shot and layout must match it. The shot
+ * is dropped from the order (if the game contained it) and replaced by a
+ * random miss at a random point, which gives the same distribution as
+ * sampling the game from scratch.
+ */
+void advance_game(const squid_layout &layout, const partial_solution &partial, u32 shot_pos, game_set &games, u32 game, std::mt19937 &rng)
+{
+	u8 positions[MAX_DEPTH];
+	u32 positions_set = 0;
+
+	for (u32 i = 0; i < games.depth; ++i)
+	{
+		u32 pos = games.get_pos(game, i);
+		if (pos != shot_pos)
+		{
+			positions[positions_set++] = static_cast<u8>(pos);
+		}
+	}
+
+	if (positions_set < games.depth)
+	{
+		square_mask free = ~(layout.combined | partial.shot_locations);
+		for (u32 i = 0; i < positions_set; ++i)
+		{
+			free &= ~(1ull << positions[i]);
+		}
+
+		assert(free != 0);
+		u32 miss = __builtin_ctzll(bits::select_bit(randint(rng, __builtin_popcountll(free) - 1), free));
+		u32 at = randint(rng, positions_set);
+
+		std::memmove(&positions[at+1], &positions[at], positions_set - at);
+		positions[at] = static_cast<u8>(miss);
+	}
+
+	fill_game(layout, partial, positions, games, game);
+}
+
+/* Call f with std::integral_constant<u32, STRIDE> for the row strides that
+ * have specialized kernels, or with STRIDE 0 (use games.stride) otherwise */
+template<typename F>
+auto dispatch_stride(u32 stride, F &&f)
+{
+	switch (stride)
+	{
+	case 8:
+		return f(std::integral_constant<u32, 8>());
+	case 16:
+		return f(std::integral_constant<u32, 16>());
+	case 24:
+		return f(std::integral_constant<u32, 24>());
+	case 32:
+		return f(std::integral_constant<u32, 32>());
+	default:
+		return f(std::integral_constant<u32, 0>());
+	}
+}
+
+template<u32 STRIDE>
+const u8 *game_row(const game_set &games, u32 game)
+{
+	return games.shots + static_cast<size_t>(game) * (STRIDE ? STRIDE : games.stride);
+}
+
+/* Row word in an order that compares like the bytes of the row */
+inline u64 row_word(const u8 *row, u32 word)
+{
+	u64 value;
+	std::memcpy(&value, row + 8 * word, sizeof(value));
+	return __builtin_bswap64(value);
+}
+
+template<u32 WORDS>
+void sort_order(const game_set &games, u32 *order, arena &scratch)
+{
+	struct sort_key
+	{
+		u64 words[WORDS];
+		double weight;
+		u32 game;
+	};
+
+	sort_key *keys = scratch.alloc<sort_key>(games.count);
+	for (u32 i = 0; i < games.count; ++i)
+	{
+		const u8 *row = game_row<WORDS * 8>(games, i);
+		for (u32 w = 0; w < WORDS; ++w)
+		{
+			keys[i].words[w] = row_word(row, w);
+		}
+		keys[i].weight = games.weights[i];
+		keys[i].game = i;
+	}
+
+	std::sort(keys, keys + games.count, [] (const sort_key &a, const sort_key &b)
+	{
+		for (u32 w = 0; w < WORDS; ++w)
+		{
+			if (a.words[w] != b.words[w])
+			{
+				return a.words[w] < b.words[w];
+			}
+		}
+		return a.weight < b.weight;
+	});
+
+	for (u32 i = 0; i < games.count; ++i)
+	{
+		order[i] = keys[i].game;
+	}
+}
+
+/* Copy of games sorted by shot sequence, then weight */
+game_set sort_games(const game_set &games, arena &scratch)
+{
+	PROFILE_SCOPE("sort_games");
+
+	u32 *order = scratch.alloc<u32>(games.count);
+
+	dispatch_stride(games.stride, [&] (auto stride)
+	{
+		if constexpr (decltype(stride)::value != 0)
+		{
+			sort_order<decltype(stride)::value / 8>(games, order, scratch);
+		}
+		else
+		{
+			for (u32 i = 0; i < games.count; ++i)
+			{
+				order[i] = i;
+			}
+
+			std::sort(order, order + games.count, [&] (u32 a, u32 b)
+			{
+				int cmp = std::memcmp(games.row(a), games.row(b), games.stride);
+				return cmp < 0 || (cmp == 0 && games.weights[a] < games.weights[b]);
+			});
+		}
+	});
+
+	game_set sorted = alloc_games(games.depth, games.count, scratch);
+	for (u32 i = 0; i < games.count; ++i)
+	{
+		std::memcpy(sorted.row(i), games.row(order[i]), games.stride);
+		sorted.weights[i] = games.weights[order[i]];
+		sorted.layout_ids[i] = games.layout_ids[order[i]];
+	}
+
+	return sorted;
+}
+
+template<u32 STRIDE>
+double calc_score(const game_set &games, u32 level, u32 &it, u32 end)
+{
+	if (level == games.depth)
+	{
+		double score = games.weights[it];
+		it++;
+		return score;
+	}
+
+	const u8 *start = game_row<STRIDE>(games, it);
+
+	double best_miss = 0.0;
+	double best_hit = 0.0;
+	double best_sink = 0.0;
+
+	while(1) {
+		u8 raw = game_row<STRIDE>(games, it)[level];
+
+		double score = calc_score<STRIDE>(games, level+1, it, end);
+
+		if (raw & 1u)
+		{
+			best_sink = std::max(score, best_sink);
+		}
+		else if (raw & 2u)
+		{
+			best_hit = std::max(score, best_hit);
+		}
+		else
+		{
+			best_miss = std::max(score, best_miss);
+		}
+
+		if (it == end)
+		{
+			break;
+		}
+
+		const u8 *next = game_row<STRIDE>(games, it);
+		if (std::memcmp(start, next, level) != 0 || (start[level] >> 2) != (next[level] >> 2))
+		{
+			break;
+		}
+	}
+
+	return best_miss + best_hit + best_sink;
+}
+
+/* Subtrees smaller than this are scored sequentially */
+const u32 PARALLEL_SUBTREE_GAMES = 2048;
+
+/* Same result as calc_score, but scores the subtrees of large groups in
+ * parallel. [begin, end) must be exactly the games calc_score would consume
+ * at this level. */
+template<u32 STRIDE>
+double calc_score_parallel(const game_set &games, u32 level, u32 begin, u32 end, arena &scratch)
+{
+	if (level + 1 >= games.depth || end - begin < PARALLEL_SUBTREE_GAMES)
+	{
+		u32 it = begin;
+		return calc_score<STRIDE>(games, level, it, end);
+	}
+
+	/* Split into the runs calc_score(level+1, ...) would consume */
+	auto starts_run = [&] (u32 it)
+	{
+		const u8 *row = game_row<STRIDE>(games, it);
+		const u8 *prev = game_row<STRIDE>(games, it - 1);
+		return row[level] != prev[level] || (row[level+1] >> 2) != (prev[level+1] >> 2);
+	};
+
+	size_t runs = 1;
+	for (u32 it = begin + 1; it != end; ++it)
+	{
+		runs += starts_run(it) ? 1 : 0;
+	}
+
+	u32 *bounds = scratch.alloc<u32>(runs + 1);
+	double *scores = scratch.alloc<double>(runs);
+
+	size_t run = 0;
+	bounds[run++] = begin;
+	for (u32 it = begin + 1; it != end; ++it)
+	{
+		if (starts_run(it))
+		{
+			bounds[run++] = it;
+		}
+	}
+	bounds[run] = end;
+
+	scheduler::parallel_for(0, runs, 1, [&] (size_t lo, size_t hi)
+	{
+		for (size_t i = lo; i < hi; ++i)
+		{
+			scores[i] = calc_score_parallel<STRIDE>(games, level+1, bounds[i], bounds[i+1], scratch);
+		}
+	});
+
+	double best_miss = 0.0;
+	double best_hit = 0.0;
+	double best_sink = 0.0;
+
+	for (size_t i = 0; i < runs; ++i)
+	{
+		if (games.is_sank_squid(bounds[i], level))
+		{
+			best_sink = std::max(scores[i], best_sink);
+		}
+		else if (games.is_hit(bounds[i], level))
+		{
+			best_hit = std::max(scores[i], best_hit);
+		}
+		else
+		{
+			best_miss = std::max(scores[i], best_miss);
+		}
+	}
+
+	return best_miss + best_hit + best_sink;
+}
+
+/* Fill games [begin, end) with random games. Each block of samples gets its
+ * own stream below a seed drawn from rng (see streams.h), so the sample set
+ * does not depend on how the blocks are scheduled. */
+void sample_games(const layout_view &layouts, const partial_solution &partial, game_set &games, u32 begin, u32 end, std::mt19937 &rng)
+{
+	PROFILE_SCOPE("sample_games");
+	PROFILE_COUNT("games_sampled", end - begin);
+
+	const u32 SAMPLE_BLOCK = 4096;
+
+	streams::parallel_blocks(streams::draw_seed(rng), {}, end - begin, SAMPLE_BLOCK, [&] (size_t first, size_t last, std::mt19937 &block_rng)
+	{
+		for (size_t i = begin + first; i < begin + last; ++i)
+		{
+			gen_random_game(layouts, partial, games, static_cast<u32>(i), block_rng);
+		}
+	});
+}
+
+struct shot_choice
+{
+	u32 position = ~0u;
+	double score = -1.0;
+
+	/* Half width of the confidence interval of score, if known */
+	double interval = 0.0;
+
+	/* Games scored to make the choice */
+	u64 games = 0;
+};
+
+/* Score every opening of a sorted set of games. Writes the opening
+ * positions and their scores and returns the number of openings. */
+u32 score_openings(const game_set &games, u32 *positions, double *scores, arena &scratch)
+{
+	PROFILE_SCOPE("score_openings");
+
+	/* Split by opening position and score each opening in parallel */
+	u32 n_openings = 0;
+	u32 *openings = scratch.alloc<u32>(64 + 1);
+	for (u32 it = 0; it != games.count; ++it)
+	{
+		if (it == 0 || games.get_pos(it, 0) != games.get_pos(it-1, 0))
+		{
+			positions[n_openings] = games.get_pos(it, 0);
+			openings[n_openings++] = it;
+		}
+	}
+	openings[n_openings] = games.count;
+
+	dispatch_stride(games.stride, [&] (auto stride)
+	{
+		scheduler::parallel_for(0, n_openings, 1, [&] (size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				scores[i] = calc_score_parallel<decltype(stride)::value>(games, 0, openings[i], openings[i+1], scratch);
+			}
+		});
+	});
+
+	return n_openings;
+}
+
+/* Score every opening of a sorted set of games and return the best one */
+shot_choice best_opening(const game_set &games, arena &scratch)
+{
+	u32 positions[64];
+	double scores[64];
+	u32 n_openings = score_openings(games, positions, scores, scratch);
+
+	/* Find best opening */
+	shot_choice best;
+	best.games = games.count;
+
+	for (u32 i = 0; i < n_openings; ++i)
+	{
+		if (scores[i] > best.score)
+		{
+			best.position = positions[i];
+			best.score = scores[i];
+		}
+	}
+
+	return best;
+}
+
+/* How search_best_shot draws the layouts of its sampled games */
+enum class sampler
+{
+	/* Uniformly over layouts, each game weighted by its layout probability */
+	uniform,
+
+	/* Independently in proportion to layout probability (alias method) */
+	alias,
+
+	/* Systematically in proportion to layout probability, so each layout
+	 * is drawn within one of its expected number of times */
+	stratified,
+};
+
+struct search_options
+{
+	/* Shots per sampled game */
+	u32 depth = 18;
+
+	/* Games to score in total */
+	u32 n_samples = 100000;
+
+	sampler kind = sampler::uniform;
+
+	/* The proportional samplers score all candidate shots on the same
+	 * layouts, in up to this many independent rounds, and drop a candidate
+	 * once the leader beats it by z standard errors */
+	u32 rounds = 16;
+	u32 min_rounds = 3;
+	double z = 2.58;
+};
+
+/* Vose's alias table for drawing layouts in proportion to probability */
+struct alias_table
+{
+	u32 n = 0;
+	double *prob = nullptr;
+	u32 *alias = nullptr;
+
+	void build(const layout_view &layouts, arena &scratch)
+	{
+		n = layouts.size();
+		prob = scratch.alloc<double>(n);
+		alias = scratch.alloc<u32>(n);
+
+		double total = 0.0;
+		for (u32 i = 0; i < n; ++i)
+		{
+			total += layouts[i].probability;
+		}
+
+		u32 *small = scratch.alloc<u32>(n);
+		u32 *large = scratch.alloc<u32>(n);
+		u32 n_small = 0, n_large = 0;
+
+		for (u32 i = 0; i < n; ++i)
+		{
+			prob[i] = layouts[i].probability * n / total;
+			alias[i] = i;
+
+			if (prob[i] < 1.0)
+			{
+				small[n_small++] = i;
+			}
+			else
+			{
+				large[n_large++] = i;
+			}
+		}
+
+		while (n_small > 0 && n_large > 0)
+		{
+			u32 less = small[--n_small];
+			u32 more = large[--n_large];
+
+			alias[less] = more;
+			prob[more] -= 1.0 - prob[less];
+
+			if (prob[more] < 1.0)
+			{
+				small[n_small++] = more;
+			}
+			else
+			{
+				large[n_large++] = more;
+			}
+		}
+
+		/* Whatever is left over is 1 up to rounding */
+		while (n_large > 0)
+		{
+			prob[large[--n_large]] = 1.0;
+		}
+		while (n_small > 0)
+		{
+			prob[small[--n_small]] = 1.0;
+		}
+	}
+
+	u32 draw(std::mt19937 &rng) const
+	{
+		u32 i = randint(rng, n - 1);
+		return std::generate_canonical<double, 53>(rng) < prob[i] ? i : alias[i];
+	}
+};
+
+/* Draws layouts (as indices into a layout_view) in proportion to their
+ * probability */
+struct layout_sampler
+{
+	sampler kind = sampler::alias;
+	alias_table table;
+
+	/* Running sum of layout probabilities, for systematic sampling */
+	double *cumulative = nullptr;
+	u32 n = 0;
+
+	void build(const layout_view &layouts, sampler sampling, arena &scratch)
+	{
+		kind = sampling;
+		n = layouts.size();
+
+		if (kind == sampler::alias)
+		{
+			table.build(layouts, scratch);
+			return;
+		}
+
+		cumulative = scratch.alloc<double>(n);
+
+		double sum = 0.0;
+		for (u32 i = 0; i < n; ++i)
+		{
+			sum += layouts[i].probability;
+			cumulative[i] = sum;
+		}
+	}
+
+	void draw(u32 count, u32 *draws, std::mt19937 &rng) const
+	{
+		if (kind == sampler::alias)
+		{
+			for (u32 i = 0; i < count; ++i)
+			{
+				draws[i] = table.draw(rng);
+			}
+			return;
+		}
+
+		/* Systematic sampling: count evenly spaced points with one random
+		 * offset, each found by searching on from the previous one */
+		const double step = cumulative[n - 1] / count;
+		double point = std::generate_canonical<double, 53>(rng) * step;
+		const double *it = cumulative;
+
+		for (u32 i = 0; i < count; ++i, point += step)
+		{
+			it = std::upper_bound(it, static_cast<const double *>(cumulative + n), point);
+			draws[i] = static_cast<u32>(std::min<ptrdiff_t>(it - cumulative, n - 1));
+		}
+	}
+};
+
+/*
+ * Common random numbers: every drawn layout is played once per candidate
+ * first shot, so the candidates are compared on the same layouts and shot
+ * orders. The game for candidate c is the layout's random shot order with c
+ * moved to the front, dropping the last miss if c was not in it. Games
+ * [k * n_draws, (k + 1) * n_draws) open with candidates[k], each weighted
+ * 1 / n_draws.
+ */
+void sample_common_games(const layout_view &layouts, const partial_solution &partial, const u32 *draws, u32 n_draws,
+						 const u8 *candidates, u32 n_candidates, game_set &games, std::mt19937 &rng)
+{
+	PROFILE_SCOPE("sample_games");
+	PROFILE_COUNT("games_sampled", n_draws * n_candidates);
+
+	const u32 SAMPLE_BLOCK = 256;
+
+	streams::parallel_blocks(streams::draw_seed(rng), {}, n_draws, SAMPLE_BLOCK, [&] (size_t first, size_t last, std::mt19937 &block_rng)
+	{
+		for (size_t i = first; i < last; ++i)
+		{
+			const squid_layout layout = layouts[draws[i]];
+
+			u8 order[MAX_DEPTH];
+			u32 n_order = random_shot_order(layout, partial, games.depth, order, block_rng);
+
+			/* Last miss in the order, or the last shot if all hit */
+			u32 last_miss = n_order - 1;
+			while (last_miss > 0 && (layout.combined & (1ull << order[last_miss])) != 0)
+			{
+				last_miss--;
+			}
+			if ((layout.combined & (1ull << order[last_miss])) != 0)
+			{
+				last_miss = n_order - 1;
+			}
+
+			for (u32 k = 0; k < n_candidates; ++k)
+			{
+				const u8 candidate = candidates[k];
+				const u32 skip = std::find(order, order + n_order, candidate) != order + n_order ? ~0u : last_miss;
+
+				u8 positions[MAX_DEPTH];
+				u32 positions_set = 0;
+
+				positions[positions_set++] = candidate;
+				for (u32 j = 0; j < n_order && positions_set < games.depth; ++j)
+				{
+					if (order[j] != candidate && j != skip)
+					{
+						positions[positions_set++] = order[j];
+					}
+				}
+
+				const u32 game = k * n_draws + i;
+				fill_game(layout, partial, positions, games, game);
+				games.weights[game] = 1.0 / n_draws;
+				games.layout_ids[game] = layouts.ids[draws[i]];
+			}
+		}
+	});
+}
+
+/*
+ * Race the unshot squares against each other over independent rounds of
+ * common random number games. After each round a candidate is dropped once
+ * the leader's mean score beats it by z standard errors of their paired
+ * difference; the search stops when one candidate is left or the sample
+ * budget is spent. Scores estimate the probability of finding all squids
+ * within depth shots.
+ */
+shot_choice race_best_shot(const layout_view &layouts, const partial_solution &partial, const search_options &options, u32 depth, std::mt19937 &rng, arena &scratch)
+{
+	u8 candidates[64];
+	u32 n_candidates = 0;
+	for (u32 pos = 0; pos < 64; ++pos)
+	{
+		if ((partial.shot_locations & (1ull << pos)) == 0)
+		{
+			candidates[n_candidates++] = static_cast<u8>(pos);
+		}
+	}
+
+	shot_choice best;
+	if (n_candidates <= 1 || depth == 0)
+	{
+		best.position = n_candidates > 0 ? candidates[0] : ~0u;
+		return best;
+	}
+
+	layout_sampler draw_sampler;
+	draw_sampler.build(layouts, options.kind, scratch);
+
+	/* Per round score of every candidate, by square */
+	const u32 rounds = std::max(options.rounds, 1u);
+	double *round_scores = scratch.alloc<double>(static_cast<size_t>(rounds) * 64);
+
+	auto mean_and_error = [&] (u32 done, auto value, double &mean, double &error)
+	{
+		double sum = 0.0, sum_squares = 0.0;
+		for (u32 r = 0; r < done; ++r)
+		{
+			double v = value(r);
+			sum += v;
+			sum_squares += v * v;
+		}
+
+		mean = sum / done;
+		double variance = done > 1 ? std::max(0.0, (sum_squares - sum * mean) / (done - 1)) : 0.0;
+		error = std::sqrt(variance / done);
+	};
+
+	u32 leader = candidates[0];
+	u32 done = 0;
+
+	while (done < rounds)
+	{
+		u32 n_draws = std::max(1u, options.n_samples / rounds / n_candidates);
+
+		u32 *draws = scratch.alloc<u32>(n_draws);
+		draw_sampler.draw(n_draws, draws, rng);
+
+		game_set games = alloc_games(depth, n_draws * n_candidates, scratch);
+		sample_common_games(layouts, partial, draws, n_draws, candidates, n_candidates, games, rng);
+		best.games += games.count;
+
+		u32 positions[64];
+		double scores[64];
+		u32 n_openings = score_openings(sort_games(games, scratch), positions, scores, scratch);
+
+		double *scores_by_square = round_scores + static_cast<size_t>(done) * 64;
+		for (u32 i = 0; i < n_openings; ++i)
+		{
+			scores_by_square[positions[i]] = scores[i];
+		}
+		done++;
+
+		/* Leader by mean score, lowest square on ties */
+		double leader_mean = -1.0, leader_error = 0.0;
+		for (u32 k = 0; k < n_candidates; ++k)
+		{
+			double mean, error;
+			mean_and_error(done, [&] (u32 r) { return round_scores[r * 64 + candidates[k]]; }, mean, error);
+
+			if (mean > leader_mean)
+			{
+				leader = candidates[k];
+				leader_mean = mean;
+				leader_error = error;
+			}
+		}
+
+		best.position = leader;
+		best.score = leader_mean;
+		best.interval = options.z * leader_error;
+
+		if (done < options.min_rounds)
+		{
+			continue;
+		}
+
+		/* Drop the candidates the leader is separated from */
+		u32 kept = 0;
+		for (u32 k = 0; k < n_candidates; ++k)
+		{
+			double mean, error;
+			mean_and_error(done, [&] (u32 r) { return round_scores[r * 64 + leader] - round_scores[r * 64 + candidates[k]]; }, mean, error);
+
+			if (candidates[k] == leader || mean - options.z * error <= 0.0)
+			{
+				candidates[kept++] = candidates[k];
+			}
+		}
+		n_candidates = kept;
+
+		if (n_candidates == 1)
+		{
+			break;
+		}
+	}
+
+	return best;
+}
+
+/* Best next shot among the given layouts, found by searching
+ * options.n_samples randomly sampled games of options.depth shots. The depth
+ * is capped at the number of unshot squares. */
+shot_choice search_best_shot(const layout_view &layouts, const partial_solution &partial, const search_options &options, std::mt19937 &rng, arena &scratch)
+{
+	u32 depth = std::min(options.depth, unshot_squares(partial));
+
+	if (options.kind != sampler::uniform)
+	{
+		return race_best_shot(layouts, partial, options, depth, rng, scratch);
+	}
+
+	/* Randomly sample possible winning games */
+	game_set games = alloc_games(depth, options.n_samples, scratch);
+	sample_games(layouts, partial, games, 0, options.n_samples, rng);
+
+	/* Sort games */
+	game_set sorted = sort_games(games, scratch);
+
+	return best_opening(sorted, scratch);
+}
+
+/* Search options.depth shots deep (at most MAX_DEPTH) for the best next shot */
+std::pair<u32,u32> find_best_position(const search_options &options, const layout_index &index, const partial_solution &partial, std::mt19937 &rng, solver_workspace &workspace)
+{
+	assert(options.depth >= 1 && options.depth <= MAX_DEPTH);
+
+	arena &scratch = workspace.scratch;
+	scratch.reset();
+
+	/* Only consider layouts that match the partial solution */
+	layout_view layouts = filter_layouts(index, partial, workspace.layout_bits, workspace.layout_ids);
+
+	shot_choice best = search_best_shot(layouts, partial, options, rng, scratch);
+
+	cout << best.score;
+	if (best.interval > 0.0)
+	{
+		cout << " +/- " << best.interval;
+	}
+	cout << " (" << best.games << " games)" << endl;
+
+	return std::pair<u32,u32>(best.position % 8, best.position / 8);
+}
+
+/* The random stream of a search from a game state, so its result depends on
+ * the seed and the state only, not on what was searched before */
+std::mt19937 state_generator(u64 seed, const partial_solution &partial)
+{
+	return streams::generator(seed, {partial.shot_locations, partial.revealed_squids, partial.squids_found});
+}
+
+/*
+ * Opening book: the recommended shot for every early game state, computed
+ * offline. States are keyed by their partial solution, reduced to a
+ * canonical form under the eight symmetries of the board, so different
+ * shot orders and mirrored games share one entry.
+ *
+ * File layout: a book_header followed by header.count book_entry records
+ * sorted by key. The file is mapped read-only and binary searched.
+ */
+const char BOOK_MAGIC[8] = {'S', 'K', 'B', 'O', 'O', 'K', '1', 0};
+
+/* book_entry::hits has a bit for every shot */
+const u32 MAX_BOOK_DEPTH = 32;
+
+struct book_header
+{
+	char magic[8];
+	u32 count;
+	u32 depth;
+};
+
+struct book_entry
+{
+	u64 shots;
+	/* revealed squids, compressed to the shot squares with pext */
+	u32 hits;
+	u8 squids_found;
+	u8 move;
+	u8 reserved[2];
+
+	bool operator< (const book_entry &other) const
+	{
+		return std::tie(shots, hits, squids_found) < std::tie(other.shots, other.hits, other.squids_found);
+	}
+};
+
+static_assert(sizeof(book_entry) == 16, "book_entry must stay 16 bytes");
+
+/* One of the eight symmetries of the board. Bit 0 mirrors x, bit 1 mirrors
+ * y and bit 2 transposes (after mirroring). */
+u32 transform_square(u32 pos, u32 symmetry)
+{
+	u32 x = pos % WIDTH;
+	u32 y = pos / WIDTH;
+
+	if (symmetry & 1)
+	{
+		x = WIDTH - 1 - x;
+	}
+	if (symmetry & 2)
+	{
+		y = WIDTH - 1 - y;
+	}
+	if (symmetry & 4)
+	{
+		std::swap(x, y);
+	}
+
+	return square_offset(x, y);
+}
+
+u32 inverse_transform_square(u32 pos, u32 symmetry)
+{
+	u32 x = pos % WIDTH;
+	u32 y = pos / WIDTH;
+
+	if (symmetry & 4)
+	{
+		std::swap(x, y);
+	}
+	if (symmetry & 2)
+	{
+		y = WIDTH - 1 - y;
+	}
+	if (symmetry & 1)
+	{
+		x = WIDTH - 1 - x;
+	}
+
+	return square_offset(x, y);
+}
+
+square_mask transform_mask(square_mask mask, u32 symmetry)
+{
+	square_mask result = 0;
+	while (mask)
+	{
+		result |= 1ull << transform_square(__builtin_ctzll(mask), symmetry);
+		mask &= mask - 1;
+	}
+	return result;
+}
+
+/* Canonical form of a partial solution and the symmetry that produces it */
+partial_solution canonical_partial(const partial_solution &partial, u32 &symmetry)
+{
+	partial_solution best = partial;
+	symmetry = 0;
+
+	for (u32 t = 1; t < 8; ++t)
+	{
+		partial_solution candidate = partial;
+		candidate.shot_locations = transform_mask(partial.shot_locations, t);
+		candidate.revealed_squids = transform_mask(partial.revealed_squids, t);
+
+		if (std::tie(candidate.shot_locations, candidate.revealed_squids) <
+			std::tie(best.shot_locations, best.revealed_squids))
+		{
+			best = candidate;
+			symmetry = t;
+		}
+	}
+
+	return best;
+}
+
+book_entry book_key(const partial_solution &canonical)
+{
+	book_entry key = {};
+	key.shots = canonical.shot_locations;
+	key.hits = static_cast<u32>(bits::extract(canonical.revealed_squids, canonical.shot_locations));
+	key.squids_found = static_cast<u8>(canonical.squids_found);
+	return key;
+}
+
+class opening_book
+{
+	void *mapping = MAP_FAILED;
+	size_t mapping_size = 0;
+	const book_entry *entries = nullptr;
+	u32 count = 0;
+	u32 book_depth = 0;
+
+public:
+
+	opening_book() = default;
+	opening_book(const opening_book &) = delete;
+	opening_book &operator= (const opening_book &) = delete;
+
+	~opening_book()
+	{
+		if (mapping != MAP_FAILED)
+		{
+			munmap(mapping, mapping_size);
+		}
+	}
+
+	bool open(const char *path)
+	{
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(book_header))
+		{
+			close(fd);
+			return false;
+		}
+
+		mapping_size = static_cast<size_t>(st.st_size);
+		mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (mapping == MAP_FAILED)
+		{
+			return false;
+		}
+
+		const book_header *header = static_cast<const book_header *>(mapping);
+		if (std::memcmp(header->magic, BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0 || header->depth > MAX_BOOK_DEPTH ||
+			mapping_size < sizeof(book_header) + static_cast<size_t>(header->count) * sizeof(book_entry) ||
+			!valid_entries(reinterpret_cast<const book_entry *>(header + 1), header->count))
+		{
+			munmap(mapping, mapping_size);
+			mapping = MAP_FAILED;
+			return false;
+		}
+
+		entries = reinterpret_cast<const book_entry *>(header + 1);
+		count = header->count;
+		book_depth = header->depth;
+
+		return true;
+	}
+
+	/* lookup() does a binary search and returns the move as a square, so a
+	 * book is only used if its entries are in strictly increasing order
+	 * and every move is a square not shot yet */
+	static bool valid_entries(const book_entry *first, u32 n)
+	{
+		for (u32 i = 0; i < n; ++i)
+		{
+			if (first[i].move >= 64 || (first[i].shots & (1ull << first[i].move)) || (i > 0 && !(first[i - 1] < first[i])))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	u32 size() const
+	{
+		return count;
+	}
+
+	u32 depth() const
+	{
+		return book_depth;
+	}
+
+	/* Recommended shot for partial, if the book has one */
+	bool lookup(const partial_solution &partial, u32 &move) const
+	{
+		if (!entries)
+		{
+			return false;
+		}
+
+		u32 symmetry;
+		book_entry key = book_key(canonical_partial(partial, symmetry));
+
+		const book_entry *it = std::lower_bound(entries, entries + count, key);
+		if (it == entries + count || key < *it)
+		{
+			PROFILE_COUNT("book_misses", 1);
+			return false;
+		}
+
+		PROFILE_COUNT("book_hits", 1);
+		move = inverse_transform_square(it->move, symmetry);
+		return true;
+	}
+};
+
+/* Walk every observation sequence of up to depth shots from the empty
+ * board, asking choose(canonical partial) once per canonical state, and
+ * write the book to path. */
+template<typename F>
+bool build_opening_book(const layout_index &index, u32 depth, const F &choose, const char *path)
+{
+	std::map<book_entry, u8> moves;
+	std::vector<u64> bits(index.words());
+
+	auto possible = [&] (const partial_solution &partial)
+	{
+		index.filter(partial, bits.data());
+		return std::any_of(bits.begin(), bits.end(), [] (u64 word) { return word != 0; });
+	};
+
+	std::function<void(const partial_solution &, u32)> explore = [&] (const partial_solution &partial, u32 shots)
+	{
+		if (shots >= depth || partial.squids_found == 3)
+		{
+			return;
+		}
+
+		u32 symmetry;
+		partial_solution canonical = canonical_partial(partial, symmetry);
+		book_entry key = book_key(canonical);
+
+		auto it = moves.find(key);
+		if (it == moves.end())
+		{
+			it = moves.emplace(key, static_cast<u8>(choose(canonical))).first;
+			cout << "\r" << moves.size() << " states" << std::flush;
+		}
+
+		const u32 move = inverse_transform_square(it->second, symmetry);
+		const square_mask pos_mask = 1ull << move;
+
+		partial_solution miss = partial;
+		miss.shot_locations |= pos_mask;
+
+		partial_solution hit = miss;
+		hit.revealed_squids |= pos_mask;
+
+		partial_solution sink = hit;
+		sink.squids_found++;
+
+		for (const partial_solution &child : {miss, hit, sink})
+		{
+			if (possible(child))
+			{
+				explore(child, shots + 1);
+			}
+		}
+	};
+
+	explore(partial_solution{}, 0);
+	cout << endl;
+
+	FILE *f = std::fopen(path, "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	book_header header = {};
+	std::memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+	header.count = static_cast<u32>(moves.size());
+	header.depth = depth;
+
+	bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+	for (auto &entry : moves)
+	{
+		book_entry record = entry.first;
+		record.move = entry.second;
+		ok = ok && std::fwrite(&record, sizeof(record), 1, f) == 1;
+	}
+
+	return std::fclose(f) == 0 && ok;
+}
+
+/*
+ * State of one game played interactively. The surviving layouts and the
+ * sampled games are carried over from move to move: each observation only
+ * narrows the previous survivor set, and every sampled game whose layout is
+ * still possible is advanced past the new shot instead of being resampled.
+ */
+class play_session
+{
+	const layout_index &index;
+	const std::vector<squid_layout> &all_layouts;
+	const search_options options;
+	const u32 depth;
+	const u32 n_samples;
+	const bool greedy;
+	const opening_book *book;
+
+	partial_solution partial;
+	std::vector<u64> alive;
+	std::vector<u64> narrowed;
+	std::vector<u32> survivors;
+	arena scratch;
+
+	/* Storage for n_samples games, of which games.count are in use */
+	std::vector<u8> game_shots;
+	std::vector<double> game_weights;
+	std::vector<u32> game_layout_ids;
+	game_set games;
+
+public:
+
+	/* With greedy set, recommend the most likely square instead of
+	 * searching sampled games. States found in book (if any) are answered
+	 * from it without searching. */
+	play_session(const layout_index &layouts, const search_options &search, bool greedy_policy, const opening_book *opening)
+		: index(layouts), all_layouts(layouts.layouts()), options(search), depth(search.depth), n_samples(search.n_samples),
+		  greedy(greedy_policy), book(opening)
+	{
+		alive.resize(index.words());
+		narrowed.resize(index.words());
+		survivors.reserve(index.size());
+
+		games.depth = depth;
+		games.stride = game_set::stride_for(depth);
+		game_shots.resize(static_cast<size_t>(n_samples) * games.stride);
+		game_weights.resize(n_samples);
+		game_layout_ids.resize(n_samples);
+		games.shots = game_shots.data();
+		games.weights = game_weights.data();
+		games.layout_ids = game_layout_ids.data();
+
+		reset();
+	}
+
+	void reset()
+	{
+		partial = {};
+
+		index.fill(alive.data());
+		index.extract(alive.data(), survivors);
+
+		games.count = 0;
+	}
+
+	const partial_solution &state() const
+	{
+		return partial;
+	}
+
+	u32 layouts_left() const
+	{
+		return static_cast<u32>(survivors.size());
+	}
+
+	bool finished() const
+	{
+		return partial.squids_found == 3;
+	}
+
+	square_heatmap heatmap()
+	{
+		scratch.reset();
+
+		layout_view layouts{all_layouts.data(), survivors.data(), static_cast<u32>(survivors.size())};
+
+		square_heatmap result;
+		compute_heatmap(layouts, result, scratch);
+
+		return result;
+	}
+
+	shot_choice most_likely_square()
+	{
+		square_heatmap map = heatmap();
+
+		shot_choice best;
+		best.position = map.most_likely(partial.shot_locations);
+		best.score = map.occupied[best.position];
+
+		return best;
+	}
+
+	/* Record a shot. Returns false and leaves the state untouched if no
+	 * layout agrees with it. */
+	bool observe(u32 pos, bool hit, bool sank_squid, std::mt19937 &rng)
+	{
+		assert(pos < 64);
+		const square_mask pos_mask = 1ull << pos;
+
+		if (partial.shot_locations & pos_mask)
+		{
+			return false;
+		}
+
+		/* Intersect the survivor set with the new constraint */
+		narrowed = alive;
+		index.filter_shot(partial, pos, hit, sank_squid, narrowed.data());
+
+		if (std::all_of(narrowed.begin(), narrowed.end(), [] (u64 word) { return word == 0; }))
+		{
+			return false;
+		}
+
+		std::swap(alive, narrowed);
+		index.extract(alive.data(), survivors);
+
+		/* Keep the sampled games whose layout is still possible */
+		u32 kept = 0;
+		for (u32 i = 0; i < games.count; ++i)
+		{
+			if (layout_index::test(alive.data(), games.layout_ids[i]))
+			{
+				std::memcpy(games.row(kept), games.row(i), games.stride);
+				games.weights[kept] = games.weights[i];
+				games.layout_ids[kept] = games.layout_ids[i];
+				kept++;
+			}
+		}
+		games.count = kept;
+
+		partial.shot_locations |= pos_mask;
+		if (hit)
+		{
+			partial.revealed_squids |= pos_mask;
+		}
+		if (sank_squid)
+		{
+			partial.squids_found++;
+		}
+
+		if (greedy || unshot_squares(partial) < depth)
+		{
+			/* Not enough squares left for games of depth shots */
+			games.count = 0;
+		}
+
+		for (u32 i = 0; i < games.count; ++i)
+		{
+			advance_game(all_layouts[games.layout_ids[i]], partial, pos, games, i, rng);
+		}
+
+		return true;
+	}
+
+	shot_choice recommend(std::mt19937 &rng)
+	{
+		shot_choice from_book;
+		if (book && book->lookup(partial, from_book.position))
+		{
+			return from_book;
+		}
+
+		/* Too few squares left to sample games of depth shots - fall back
+		 * to the square most likely to hold a squid */
+		if (greedy || unshot_squares(partial) < depth)
+		{
+			return most_likely_square();
+		}
+
+		scratch.reset();
+
+		layout_view layouts{all_layouts.data(), survivors.data(), static_cast<u32>(survivors.size())};
+
+		/* The proportional samplers start afresh every move */
+		if (options.kind != sampler::uniform)
+		{
+			return search_best_shot(layouts, partial, options, rng, scratch);
+		}
+
+		/* Top the reused games back up to the full sample size */
+		u32 reused = games.count;
+		games.count = n_samples;
+
+		sample_games(layouts, partial, games, reused, n_samples, rng);
+
+		return best_opening(sort_games(games, scratch), scratch);
+	}
+};
+
+/*
+ * Line based protocol for playing a game with the solver's help:
+ *
+ *   <x> <y> miss|hit|sink   report the result of a shot
+ *   heatmap                 print the squid probability of every square
+ *   reset                   start a new game
+ *   quit                    exit
+ *
+ * Every accepted shot is answered with the next recommended shot as
+ * "<x> <y>", or "done" once all squids are found. Bad input is answered
+ * with "error <reason>".
+ */
+void play_interactive(const layout_index &layouts, const search_options &options, bool greedy, const opening_book *book, std::mt19937 &rng)
+{
+	play_session session(layouts, options, greedy, book);
+
+	auto recommend = [&] ()
+	{
+		shot_choice best = session.recommend(rng);
+		cout << best.position % 8 << " " << best.position / 8 << endl;
+	};
+
+	recommend();
+
+	std::string line;
+	while (std::getline(std::cin, line))
+	{
+		std::istringstream in(line);
+		std::string first;
+
+		if (!(in >> first) || first[0] == '#')
+		{
+			continue;
+		}
+
+		if (first == "quit")
+		{
+			break;
+		}
+
+		if (first == "heatmap")
+		{
+			session.heatmap().print();
+			continue;
+		}
+
+		if (first == "reset")
+		{
+			session.reset();
+			recommend();
+			continue;
+		}
+
+		u32 x, y;
+		std::string result;
+		std::istringstream shot(line);
+		if (!(shot >> x >> y >> result) || x >= WIDTH || y >= WIDTH)
+		{
+			cout << "error expected <x> <y> miss|hit|sink" << endl;
+			continue;
+		}
+
+		bool hit = (result == "hit" || result == "h" || result == "sink" || result == "s");
+		bool sank_squid = (result == "sink" || result == "s");
+		if (!hit && result != "miss" && result != "m")
+		{
+			cout << "error unknown result '" << result << "'" << endl;
+			continue;
+		}
+
+		if (!session.observe(square_offset(x, y), hit, sank_squid, rng))
+		{
+			cout << "error shot does not match any layout" << endl;
+			continue;
+		}
+
+		if (session.finished())
+		{
+			cout << "done" << endl;
+			continue;
+		}
+
+		recommend();
+	}
+}
+
+/*
+ * Server mode: answer queries of other programs, such as a stream overlay,
+ * over a local socket (see server.h), with the layout table and its index
+ * built once. One request per line, each answered by one JSON object per
+ * line, in order:
+ *
+ *   rate <pattern> [<shots>]   chance of the pattern (16 hex digits, bit
+ *                              x + 8 y for square x, y) hitting a squid
+ *   shot [<shots>]             the recommended next shot
+ *   heatmap [<shots>]          the squid probability of every square, row
+ *                              by row
+ *   stats                      request latency percentiles
+ *   shutdown                   stop the server
+ *
+ * <shots> are the shots taken so far, each <x>,<y>,miss|hit|sink (or
+ * m|h|s), separated by spaces. Every request carries its whole game state,
+ * so clients keep no session. Bad requests, and lines longer than
+ * server::MAX_LINE, are answered with {"error":"<reason>"}.
+ *
+ * The requests that queued up while a batch was answered make up the next
+ * batch. The requests of a batch with the same game state share one
+ * filtering of the layouts, and all of their patterns are rated together
+ * (see rate_patterns). The layouts left in the last few game states are
+ * kept with their heatmap and recommended shot, so asking again about the
+ * same game costs next to nothing.
+ *
+ * A shot that needs a sampled search takes far longer than anything else,
+ * so a batch is answered in two passes: first everything cheap, which is
+ * sent at once, then the searches. Each client still gets its answers in
+ * the order of its requests; only those queued behind one of its own
+ * searches wait for it.
+ */
+struct server_query
+{
+	enum kind_t
+	{
+		rate,
+		shot,
+		heatmap,
+		stats,
+		shutdown,
+		invalid,
+	};
+
+	kind_t kind = invalid;
+	partial_solution state;
+	square_mask pattern = 0;
+	std::string error;
+};
+
+/* Game state key, for grouping queries */
+std::tuple<square_mask, square_mask, u32> state_key(const partial_solution &partial)
+{
+	return std::make_tuple(partial.shot_locations, partial.revealed_squids, partial.squids_found);
+}
+
+server_query parse_query(const std::string &line)
+{
+	server_query query;
+	std::istringstream in(line);
+
+	std::string command;
+	in >> command;
+	if (command == "rate")
+	{
+		std::string hex;
+		char *end = nullptr;
+		if (!(in >> hex) || hex.size() > 16 || (query.pattern = std::strtoull(hex.c_str(), &end, 16), *end != 0))
+		{
+			query.error = "expected rate <pattern> [<shots>]";
+			return query;
+		}
+		query.kind = server_query::rate;
+	}
+	else if (command == "shot" || command == "heatmap")
+	{
+		query.kind = command == "shot" ? server_query::shot : server_query::heatmap;
+	}
+	else if (command == "stats" || command == "shutdown")
+	{
+		query.kind = command == "stats" ? server_query::stats : server_query::shutdown;
+		return query;
+	}
+	else
+	{
+		query.error = "unknown request '" + command + "'";
+		return query;
+	}
+
+	std::string shot;
+	while (in >> shot)
+	{
+		u32 x, y;
+		char result[8];
+		if (std::sscanf(shot.c_str(), "%u,%u,%7s", &x, &y, result) != 3 || x >= WIDTH || y >= WIDTH)
+		{
+			query.kind = server_query::invalid;
+			query.error = "expected <x>,<y>,miss|hit|sink, got '" + shot + "'";
+			return query;
+		}
+
+		std::string r = result;
+		bool hit = (r == "hit" || r == "h" || r == "sink" || r == "s");
+		bool sank_squid = (r == "sink" || r == "s");
+		const square_mask pos_mask = 1ull << square_offset(x, y);
+		if ((!hit && r != "miss" && r != "m") || (query.state.shot_locations & pos_mask))
+		{
+			query.kind = server_query::invalid;
+			query.error = "bad shot '" + shot + "'";
+			return query;
+		}
+
+		query.state.shot_locations |= pos_mask;
+		if (hit)
+		{
+			query.state.revealed_squids |= pos_mask;
+		}
+		if (sank_squid)
+		{
+			query.state.squids_found++;
+		}
+	}
+
+	/* The fleet has 3 squids on 2 + 3 + 4 squares */
+	if (__builtin_popcountll(query.state.revealed_squids) > 9 || query.state.squids_found > 3)
+	{
+		query.kind = server_query::invalid;
+		query.error = "more hits or sinks than the squids have";
+	}
+
+	return query;
+}
+
+/* text as a JSON string */
+std::string json_string(const std::string &text)
+{
+	std::string json = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			json += '\\';
+			json += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			json += escaped;
+		}
+		else
+		{
+			json += c;
+		}
+	}
+	return json + "\"";
+}
+
+std::string json_number(double value)
+{
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+	return buffer;
+}
+
+std::string shot_json(const shot_choice &best)
+{
+	return "{\"x\":" + std::to_string(best.position % 8) + ",\"y\":" + std::to_string(best.position / 8) + ",\"score\":" + json_number(best.score) + "}";
+}
+
+std::string latency_json(const server::latency_log &latencies, u64 batches)
+{
+	std::string json = "{\"requests\":" + std::to_string(latencies.count()) + ",\"batches\":" + std::to_string(batches);
+	const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	const char *names[] = {"p50_us", "p90_us", "p99_us", "p999_us"};
+	for (u32 q = 0; q < 4; ++q)
+	{
+		json += ",\"" + std::string(names[q]) + "\":" + json_number(1e6 * latencies.percentile(quantiles[q]));
+	}
+	json += ",\"max_us\":" + json_number(1e6 * latencies.max()) + "}";
+	return json;
+}
+
+/* The layouts left in recently asked game states, with what was worked out
+ * for them, least recently used first out */
+class state_cache
+{
+public:
+
+	struct entry
+	{
+		std::tuple<square_mask, square_mask, u32> key;
+		std::vector<u64> bits;
+		std::vector<u32> ids;
+		layout_view layouts;
+
+		/* Probability mass of the layouts, for rate requests */
+		double total = 0.0;
+
+		bool has_heatmap = false;
+		square_heatmap heatmap;
+
+		/* The answer to a shot request, once asked */
+		std::string shot;
+
+		u64 last_used = 0;
+	};
+
+private:
+
+	const layout_index &index;
+	const size_t capacity;
+	std::vector<std::unique_ptr<entry> > entries;
+	u64 uses = 0;
+
+public:
+
+	state_cache(const layout_index &layouts, size_t states)
+		: index(layouts), capacity(states)
+	{
+	}
+
+	entry &get(const partial_solution &state)
+	{
+		const auto key = state_key(state);
+		for (auto &e : entries)
+		{
+			if (e->key == key)
+			{
+				PROFILE_COUNT("serve_cache_hits", 1);
+				e->last_used = ++uses;
+				return *e;
+			}
+		}
+
+		if (entries.size() < capacity)
+		{
+			entries.push_back(std::make_unique<entry>());
+		}
+		else
+		{
+			/* Reuse the least recently used one, with its buffers */
+			auto oldest = std::min_element(entries.begin(), entries.end(), [] (const auto &a, const auto &b) { return a->last_used < b->last_used; });
+			std::swap(*oldest, entries.back());
+		}
+
+		entry &e = *entries.back();
+		e.key = key;
+		e.layouts = filter_layouts(index, state, e.bits, e.ids);
+		e.total = index.miss_weight(e.bits.data(), 0);
+		e.has_heatmap = false;
+		e.shot.clear();
+		e.last_used = ++uses;
+		return e;
+	}
+};
+
+/* Answers of the requests of one batch, in place, except shots that need
+ * a search, which are left empty for answer_searches */
+void answer_batch(const std::vector<server_query> &queries, std::vector<std::string> &answers, const layout_index &index, state_cache &cache,
+				  const search_options &options, bool greedy, const opening_book *book, arena &scratch)
+{
+	PROFILE_SCOPE("serve_batch");
+
+	/* Requests with the same game state next to each other */
+	std::vector<u32> order;
+	for (u32 i = 0; i < queries.size(); ++i)
+	{
+		if (queries[i].kind == server_query::rate || queries[i].kind == server_query::shot || queries[i].kind == server_query::heatmap)
+		{
+			order.push_back(i);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&] (u32 a, u32 b) { return state_key(queries[a].state) < state_key(queries[b].state); });
+
+	std::vector<square_mask> patterns;
+	std::vector<u32> pattern_queries;
+	std::vector<double> hit;
+
+	for (size_t begin = 0, end; begin < order.size(); begin = end)
+	{
+		const partial_solution &state = queries[order[begin]].state;
+		for (end = begin + 1; end < order.size() && state_key(queries[order[end]].state) == state_key(state); ++end)
+		{
+		}
+
+		state_cache::entry &cached = cache.get(state);
+		if (cached.layouts.size() == 0)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				answers[order[i]] = "{\"error\":\"shots do not match any layout\"}";
+			}
+			continue;
+		}
+
+		patterns.clear();
+		pattern_queries.clear();
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (queries[order[i]].kind == server_query::rate)
+			{
+				patterns.push_back(queries[order[i]].pattern);
+				pattern_queries.push_back(order[i]);
+			}
+		}
+
+		if (!patterns.empty())
+		{
+			hit.resize(patterns.size());
+			rate_patterns(index, cached.bits.data(), cached.total, patterns.data(), static_cast<u32>(patterns.size()), hit.data());
+			for (size_t p = 0; p < patterns.size(); ++p)
+			{
+				answers[pattern_queries[p]] = "{\"hit\":" + json_number(hit[p]) + ",\"layouts\":" + std::to_string(cached.layouts.size()) + "}";
+			}
+		}
+
+		/* Too few squares left to sample games of depth shots: the shot
+		 * is the most likely square, as with greedy */
+		const bool most_likely = greedy || unshot_squares(state) < options.depth;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			const server_query &query = queries[order[i]];
+			const bool need_heatmap = query.kind == server_query::heatmap || (query.kind == server_query::shot && most_likely);
+			if (need_heatmap && !cached.has_heatmap)
+			{
+				scratch.reset();
+				compute_heatmap(cached.layouts, cached.heatmap, scratch);
+				cached.has_heatmap = true;
+			}
+
+			if (query.kind == server_query::heatmap)
+			{
+				std::string json = "{\"heatmap\":[";
+				for (u32 pos = 0; pos < 64; ++pos)
+				{
+					json += (pos ? "," : "") + json_number(cached.heatmap.occupied[pos]);
+				}
+				answers[order[i]] = json + "]}";
+			}
+			else if (query.kind == server_query::shot)
+			{
+				if (cached.shot.empty())
+				{
+					shot_choice best;
+					if (state.squids_found == 3)
+					{
+						cached.shot = "{\"done\":true}";
+					}
+					else if (book && book->lookup(state, best.position))
+					{
+						cached.shot = "{\"x\":" + std::to_string(best.position % 8) + ",\"y\":" + std::to_string(best.position / 8) + "}";
+					}
+					else if (most_likely)
+					{
+						best.position = cached.heatmap.most_likely(state.shot_locations);
+						best.score = cached.heatmap.occupied[best.position];
+						cached.shot = shot_json(best);
+					}
+				}
+				answers[order[i]] = cached.shot;
+			}
+		}
+	}
+}
+
+/* Answers of the shots answer_batch left empty */
+void answer_searches(const std::vector<server_query> &queries, std::vector<std::string> &answers, state_cache &cache,
+					 const search_options &options, u64 seed, arena &scratch)
+{
+	PROFILE_SCOPE("serve_searches");
+
+	for (size_t i = 0; i < queries.size(); ++i)
+	{
+		if (queries[i].kind != server_query::shot || !answers[i].empty())
+		{
+			continue;
+		}
+
+		/* One search per state, however often it is asked */
+		const partial_solution &state = queries[i].state;
+		state_cache::entry &cached = cache.get(state);
+		if (cached.shot.empty())
+		{
+			scratch.reset();
+			std::mt19937 rng = state_generator(seed, state);
+			cached.shot = shot_json(search_best_shot(cached.layouts, state, options, rng, scratch));
+		}
+		answers[i] = cached.shot;
+	}
+}
+
+/* Serve until a shutdown request. Returns false if address can't be
+ * listened on. */
+bool serve(const layout_index &index, const search_options &options, bool greedy, const opening_book *book, u64 seed, const std::string &address)
+{
+	const size_t MAX_BATCH = 4096;
+
+	server::line_server listener;
+	std::string error;
+	if (!listener.start(address, error))
+	{
+		cout << "Failed to listen on " << address << ": " << error << endl;
+		return false;
+	}
+	cout << "Listening on " << address << endl;
+
+	/* The game states of the last few games asked about */
+	state_cache cache(index, 16);
+	arena scratch;
+	server::latency_log latencies;
+	u64 batches = 0;
+
+	std::vector<server::request> batch;
+	std::vector<server_query> queries;
+	std::vector<std::string> answers;
+	std::vector<const server::connection *> waiting;
+	std::vector<bool> sent;
+
+	bool running = true;
+	while (running && listener.next_batch(batch, MAX_BATCH))
+	{
+		PROFILE_COUNT("serve_requests", batch.size());
+
+		queries.clear();
+		for (const auto &request : batch)
+		{
+			if (request.too_long)
+			{
+				server_query query;
+				query.error = "request too long";
+				queries.push_back(query);
+			}
+			else
+			{
+				queries.push_back(parse_query(request.line));
+			}
+		}
+
+		answers.assign(batch.size(), std::string());
+		answer_batch(queries, answers, index, cache, options, greedy, book, scratch);
+
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const server_query &query = queries[i];
+			if (query.kind == server_query::invalid)
+			{
+				answers[i] = "{\"error\":" + json_string(query.error) + "}";
+			}
+			else if (query.kind == server_query::stats)
+			{
+				answers[i] = latency_json(latencies, batches);
+			}
+			else if (query.kind == server_query::shutdown)
+			{
+				answers[i] = "{\"shutdown\":true}";
+				running = false;
+			}
+		}
+
+		/* Send what is answered, holding back the answers of a client
+		 * after its first search */
+		waiting.clear();
+		sent.assign(batch.size(), false);
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const server::connection *client = batch[i].client.get();
+			const bool held = std::find(waiting.begin(), waiting.end(), client) != waiting.end();
+			if (held || answers[i].empty())
+			{
+				if (!held)
+				{
+					waiting.push_back(client);
+				}
+				continue;
+			}
+
+			batch[i].client->send(answers[i]);
+			latencies.add(std::chrono::duration<double>(server::clock::now() - batch[i].received).count());
+			sent[i] = true;
+		}
+
+		if (!waiting.empty())
+		{
+			answer_searches(queries, answers, cache, options, seed, scratch);
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				if (!sent[i])
+				{
+					batch[i].client->send(answers[i]);
+					latencies.add(std::chrono::duration<double>(server::clock::now() - batch[i].received).count());
+				}
+			}
+		}
+		batches++;
+	}
+
+	listener.stop();
+
+	cout << "Served " << latency_json(latencies, batches) << endl;
+	return true;
+}
+
+/*
+ * Policy evaluation: play a policy against every layout (or a sample of
+ * layouts) and record how many shots it needs to sink all squids.
+ *
+ * All games are played at once as a decision tree. Games that produced the
+ * same observations so far share a node, the policy is asked once per node
+ * with every layout that agrees with those observations, and the node is
+ * split by the outcome of the chosen shot. A policy is any callable
+ *
+ *   u32 policy(const layout_view &layouts, const partial_solution &partial, u32 shots_taken, arena &scratch)
+ *
+ * returning an unshot square. It may be called from several threads.
+ */
+
+/* Number of bombs available in the minigame */
+const u32 BOMBS = 24;
+
+struct evaluation_result
+{
+	/* Probability mass of needing exactly n shots */
+	double shots[65] = {0.0};
+	u64 games = 0;
+
+	double mean() const
+	{
+		double sum = 0.0;
+		for (u32 n = 0; n <= 64; ++n)
+		{
+			sum += n * shots[n];
+		}
+		return sum;
+	}
+
+	double win_rate(u32 bombs) const
+	{
+		double sum = 0.0;
+		for (u32 n = 0; n <= std::min(bombs, 64u); ++n)
+		{
+			sum += shots[n];
+		}
+		return sum;
+	}
+
+	void print() const
+	{
+		cout << "Games: " << games << endl;
+		cout << "Mean shots: " << mean() << endl;
+		cout << "Win rate (" << BOMBS << " bombs): " << 100.0 * win_rate(BOMBS) << "%" << endl;
+		cout << "Shots  Probability  Cumulative" << endl;
+
+		double cumulative = 0.0;
+		for (u32 n = 0; n <= 64; ++n)
+		{
+			if (shots[n] <= 0.0)
+			{
+				continue;
+			}
+
+			cumulative += shots[n];
+			cout << std::setw(5) << n
+				 << std::setw(12) << std::fixed << std::setprecision(4) << 100.0 * shots[n] << "%"
+				 << std::setw(11) << 100.0 * cumulative << "%" << endl;
+		}
+
+		cout.unsetf(std::ios::floatfield);
+		cout << std::setprecision(6);
+	}
+};
+
+/* Nodes with fewer layouts than this are expanded sequentially */
+const u32 PARALLEL_NODE_LAYOUTS = 4096;
+
+/* Order ids into misses, hits and sinks of a shot at pos and return the
+ * start of the hit and sink ranges */
+template<typename F>
+void partition_outcomes(u32 *ids, u32 count, const F &layout_of, square_mask pos_mask, square_mask hits, u32 (&bounds)[4])
+{
+	auto outcome = [&] (u32 id)
+	{
+		const squid_layout &layout = layout_of(id);
+
+		if (!(layout.combined & pos_mask))
+		{
+			return 0;
+		}
+
+		const square_mask squid = (layout.squid2 & pos_mask) ? layout.squid2 :
+								  (layout.squid3 & pos_mask) ? layout.squid3 : layout.squid4;
+
+		return ((squid & hits) == squid) ? 2 : 1;
+	};
+
+	u32 misses = 0;
+	u32 next = 0;
+	u32 sinks = count;
+
+	while (next < sinks)
+	{
+		switch (outcome(ids[next]))
+		{
+		case 0:
+			std::swap(ids[misses++], ids[next++]);
+			break;
+		case 1:
+			next++;
+			break;
+		default:
+			std::swap(ids[next], ids[--sinks]);
+			break;
+		}
+	}
+
+	bounds[0] = 0;
+	bounds[1] = misses;
+	bounds[2] = sinks;
+	bounds[3] = count;
+}
+
+/*
+ * posterior[0, n_posterior) are the ids of all layouts that agree with the
+ * observations leading to this node; the policy decides based on those.
+ * entries[0, n_entries) are the indices into sample_ids of the games that
+ * are actually played through this node. Children without games are not
+ * expanded.
+ */
+template<typename P>
+void evaluate_node(const P &policy, const squid_layout *table, u32 *posterior, u32 n_posterior,
+				   const u32 *sample_ids, u32 *entries, u32 n_entries,
+				   const partial_solution &partial, u32 shots_taken, u8 *shots_needed, arena &scratch)
+{
+	if (partial.squids_found == 3)
+	{
+		for (u32 i = 0; i < n_entries; ++i)
+		{
+			shots_needed[entries[i]] = static_cast<u8>(shots_taken);
+		}
+		return;
+	}
+
+	const u32 pos = policy(layout_view{table, posterior, n_posterior}, partial, shots_taken, scratch);
+	assert(pos < 64);
+	assert(!(partial.shot_locations & (1ull << pos)));
+
+	const square_mask pos_mask = 1ull << pos;
+	const square_mask hits = partial.revealed_squids | pos_mask;
+
+	u32 posterior_bounds[4];
+	u32 entry_bounds[4];
+
+	partition_outcomes(posterior, n_posterior, [&] (u32 id) -> const squid_layout & { return table[id]; },
+					   pos_mask, hits, posterior_bounds);
+	partition_outcomes(entries, n_entries, [&] (u32 entry) -> const squid_layout & { return table[sample_ids[entry]]; },
+					   pos_mask, hits, entry_bounds);
+
+	partial_solution children[3] = {partial, partial, partial};
+
+	for (u32 c = 0; c < 3; ++c)
+	{
+		children[c].shot_locations |= pos_mask;
+	}
+	children[1].revealed_squids |= pos_mask;
+	children[2].revealed_squids |= pos_mask;
+	children[2].squids_found++;
+
+	auto expand = [&] (u32 c)
+	{
+		if (entry_bounds[c+1] > entry_bounds[c])
+		{
+			evaluate_node(policy, table,
+						  posterior + posterior_bounds[c], posterior_bounds[c+1] - posterior_bounds[c],
+						  sample_ids, entries + entry_bounds[c], entry_bounds[c+1] - entry_bounds[c],
+						  children[c], shots_taken + 1, shots_needed, scratch);
+		}
+	};
+
+	if (n_posterior < PARALLEL_NODE_LAYOUTS)
+	{
+		expand(0);
+		expand(1);
+		expand(2);
+	}
+	else
+	{
+		scheduler::parallel_for(0, 3, 1, [&] (size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; ++c)
+			{
+				expand(static_cast<u32>(c));
+			}
+		});
+	}
+}
+
+/* Play policy against the layouts sample_ids, each weighted by weights
+ * (or by the layout probability if weights is empty) */
+template<typename P>
+evaluation_result evaluate_policy(const P &policy, const std::vector<squid_layout> &table,
+								  const std::vector<u32> &sample_ids, const std::vector<double> &weights)
+{
+	const u32 n = static_cast<u32>(sample_ids.size());
+
+	std::vector<u32> posterior(table.size());
+	std::vector<u32> entries(n);
+	std::vector<u8> shots_needed(n, 0);
+
+	for (u32 i = 0; i < posterior.size(); ++i)
+	{
+		posterior[i] = i;
+	}
+
+	for (u32 i = 0; i < n; ++i)
+	{
+		entries[i] = i;
+	}
+
+	arena scratch;
+	evaluate_node(policy, table.data(), posterior.data(), static_cast<u32>(posterior.size()),
+				  sample_ids.data(), entries.data(), n, partial_solution{}, 0, shots_needed.data(), scratch);
+
+	evaluation_result result;
+	result.games = n;
+
+	double total = 0.0;
+	for (u32 i = 0; i < n; ++i)
+	{
+		double weight = weights.empty() ? table[sample_ids[i]].probability : weights[i];
+		result.shots[shots_needed[i]] += weight;
+		total += weight;
+	}
+
+	for (auto &mass : result.shots)
+	{
+		mass /= total;
+	}
+
+	return result;
+}
+
+/* Heatmap of a node, computed sequentially for small nodes */
+u32 greedy_choice(const layout_view &layouts, const partial_solution &partial, arena &scratch)
+{
+	square_heatmap heatmap;
+
+	if (layouts.size() >= PARALLEL_NODE_LAYOUTS)
+	{
+		compute_heatmap(layouts, heatmap, scratch);
+	}
+	else
+	{
+		for (u32 i = 0; i < layouts.size(); ++i)
+		{
+			const squid_layout &layout = layouts[i];
+			accumulate_squid(layout.combined, layout.probability, heatmap.occupied);
+		}
+	}
+
+	return heatmap.most_likely(partial.shot_locations);
+}
+
+struct greedy_policy
+{
+	u32 operator()(const layout_view &layouts, const partial_solution &partial, u32, arena &scratch) const
+	{
+		return greedy_choice(layouts, partial, scratch);
+	}
+};
+
+/* Shoot a fixed pattern until the first hit, then play greedily */
+struct pattern_policy
+{
+	std::vector<u8> pattern;
+
+	u32 operator()(const layout_view &layouts, const partial_solution &partial, u32, arena &scratch) const
+	{
+		if (partial.revealed_squids == 0)
+		{
+			for (u8 pos : pattern)
+			{
+				if (!(partial.shot_locations & (1ull << pos)))
+				{
+					return pos;
+				}
+			}
+		}
+
+		return greedy_choice(layouts, partial, scratch);
+	}
+};
+
+/* Sampled game search, as used by find_best_position */
+struct search_policy
+{
+	search_options options;
+	u64 seed;
+	const opening_book *book;
+
+	u32 operator()(const layout_view &layouts, const partial_solution &partial, u32, arena &) const
+	{
+		u32 move;
+		if (book && book->lookup(partial, move))
+		{
+			return move;
+		}
+
+		if (unshot_squares(partial) < options.depth)
+		{
+			arena scratch;
+			return greedy_choice(layouts, partial, scratch);
+		}
+
+		/* A stream per node so results do not depend on scheduling */
+		std::mt19937 rng = state_generator(seed, partial);
+
+		arena scratch;
+		return search_best_shot(layouts, partial, options, rng, scratch).position;
+	}
+};
+
+/* Draw n layout ids with probability proportional to their weight */
+std::vector<u32> sample_layouts(const std::vector<squid_layout> &layouts, u32 n, std::mt19937 &rng)
+{
+	std::vector<double> cumulative(layouts.size());
+
+	double sum = 0.0;
+	for (u32 i = 0; i < layouts.size(); ++i)
+	{
+		sum += layouts[i].probability;
+		cumulative[i] = sum;
+	}
+
+	std::uniform_real_distribution<double> dist(0.0, sum);
+	std::vector<u32> ids(n);
+
+	for (auto &id : ids)
+	{
+		auto it = std::upper_bound(cumulative.begin(), cumulative.end(), dist(rng));
+		id = static_cast<u32>(std::min<size_t>(it - cumulative.begin(), layouts.size() - 1));
+	}
+
+	return ids;
+}
+
+#ifndef SPLOOSHKABOOM_BENCH
+void print_usage(const char *program)
+{
+	cout << "Usage: " << program << " [options]\n"
+		 << "  --greedy                       shoot the most likely square\n"
+		 << "  --play                         advise on a game, shot by shot\n"
+		 << "  --evaluate <policy>            play a policy against the layouts\n"
+		 << "  --games <n>                    random layouts for --evaluate\n"
+		 << "  --samples <n>                  sampled games per search\n"
+		 << "  --depth <n>                    shots a search looks ahead\n"
+		 << "  --sampling uniform|alias|stratified\n"
+		 << "  --rounds <n>                   racing rounds per search\n"
+		 << "  --confidence <z>               racing confidence\n"
+		 << "  --book <file>                  opening book to use\n"
+		 << "  --build-book <file>            write an opening book\n"
+		 << "  --book-depth <n>               shots the book covers\n"
+		 << "  --serve <path>|tcp:<port>      answer queries on a socket\n"
+		 << "  --seed <n>                     seed of all random streams" << endl;
+}
+
+int main(int argc, char **argv)
+{
+	PROFILE_REPORT_AT_EXIT();
+
+	std::vector<std::pair<double, square_mask> > candidates;
+
+	auto all_layouts = generate_all_possible_squid_layouts();
+	layout_index index(all_layouts);
+
+	bool greedy = false;
+	bool play = false;
+	std::string evaluate;
+	u32 games = 0;
+	const char *book_path = nullptr;
+	const char *build_book_path = nullptr;
+	u32 book_depth = 4;
+	const char *serve_address = nullptr;
+	search_options options;
+
+	/* Seed of all random streams (see streams.h), a random one unless
+	 * given */
+	u64 seed = 0;
+	bool has_seed = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--greedy") == 0)
+		{
+			greedy = true;
+		}
+		else if (std::strcmp(argv[i], "--play") == 0)
+		{
+			play = true;
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--evaluate") == 0)
+		{
+			evaluate = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--samples") == 0)
+		{
+			options.n_samples = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--games") == 0)
+		{
+			games = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--book") == 0)
+		{
+			book_path = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--build-book") == 0)
+		{
+			build_book_path = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--book-depth") == 0)
+		{
+			book_depth = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--depth") == 0)
+		{
+			options.depth = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--sampling") == 0)
+		{
+			std::string kind = argv[++i];
+			if (kind == "uniform")
+			{
+				options.kind = sampler::uniform;
+			}
+			else if (kind == "alias")
+			{
+				options.kind = sampler::alias;
+			}
+			else if (kind == "stratified")
+			{
+				options.kind = sampler::stratified;
+			}
+			else
+			{
+				cout << "Unknown sampling '" << kind << "' (expected uniform, alias or stratified)" << endl;
+				return 1;
+			}
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--rounds") == 0)
+		{
+			options.rounds = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--confidence") == 0)
+		{
+			options.z = std::strtod(argv[++i], nullptr);
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--serve") == 0)
+		{
+			serve_address = argv[++i];
+		}
+		else if (i + 1 < argc && std::strcmp(argv[i], "--seed") == 0)
+		{
+			if (!streams::parse_seed(argv[++i], seed))
+			{
+				cout << "Seed must be a number" << endl;
+				return 1;
+			}
+			has_seed = true;
+		}
+		else
+		{
+			cout << "Unknown option or missing value: " << argv[i] << endl;
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!has_seed)
+	{
+		seed = streams::random_seed();
+	}
+
+	/* Draws in sequence, for the modes that search one state after the
+	 * other */
+	std::mt19937 rng = streams::generator(seed, {});
+
+	if (options.depth < 1 || options.depth > MAX_DEPTH)
+	{
+		cout << "Search depth must be between 1 and " << MAX_DEPTH << endl;
+		return 1;
+	}
+
+	if (build_book_path && book_depth > MAX_BOOK_DEPTH)
+	{
+		cout << "Book depth must be at most " << MAX_BOOK_DEPTH << endl;
+		return 1;
+	}
+
+	partial_solution partial = {};
+	solver_workspace workspace;
+
+	if (build_book_path)
+	{
+		if (!greedy)
+		{
+			cout << "Seed " << seed << endl;
+		}
+
+		auto choose = [&] (const partial_solution &state) -> u32
+		{
+			if (greedy)
+			{
+				return greedy_shot(index, state, workspace);
+			}
+
+			workspace.scratch.reset();
+			layout_view layouts = filter_layouts(index, state, workspace.layout_bits, workspace.layout_ids);
+			std::mt19937 state_rng = state_generator(seed, state);
+			return search_best_shot(layouts, state, options, state_rng, workspace.scratch).position;
+		};
+
+		if (!build_opening_book(index, book_depth, choose, build_book_path))
+		{
+			cout << "Failed to write " << build_book_path << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	opening_book book;
+	const opening_book *book_ptr = nullptr;
+	if (book_path)
+	{
+		if (!book.open(book_path))
+		{
+			cout << "Failed to load opening book " << book_path << endl;
+			return 1;
+		}
+		book_ptr = &book;
+	}
+
+	if (play)
+	{
+		play_interactive(index, options, greedy, book_ptr, rng);
+		return 0;
+	}
+
+	if (serve_address)
+	{
+		return serve(index, options, greedy, book_ptr, seed, serve_address) ? 0 : 1;
+	}
+
+	if (!evaluate.empty())
+	{
+		/* Every layout with its exact weight, or a probability weighted sample */
+		std::vector<u32> sample_ids;
+		std::vector<double> weights;
+
+		if (games > 0)
+		{
+			sample_ids = sample_layouts(all_layouts, games, rng);
+			weights.assign(games, 1.0 / games);
+		}
+		else
+		{
+			sample_ids.resize(all_layouts.size());
+			for (u32 i = 0; i < sample_ids.size(); ++i)
+			{
+				sample_ids[i] = i;
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		evaluation_result result;
+
+		if (evaluate == "greedy")
+		{
+			result = evaluate_policy(greedy_policy{}, all_layouts, sample_ids, weights);
+		}
+		else if (evaluate == "pattern")
+		{
+			/* "Two Lines" from the README */
+			const u32 two_lines[][2] = {{3,1}, {4,2}, {1,3}, {5,3}, {2,4}, {6,4}, {3,5}, {4,6}};
+
+			pattern_policy policy;
+			for (auto &square : two_lines)
+			{
+				policy.pattern.push_back(static_cast<u8>(square_offset(square[0], square[1])));
+			}
+
+			result = evaluate_policy(policy, all_layouts, sample_ids, weights);
+		}
+		else if (evaluate == "search")
+		{
+			result = evaluate_policy(search_policy{options, seed, book_ptr}, all_layouts, sample_ids, weights);
+		}
+		else
+		{
+			cout << "Unknown policy '" << evaluate << "' (expected greedy, pattern or search)" << endl;
+			return 1;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		cout << "Policy: " << evaluate << endl;
+		if (games > 0 || evaluate == "search")
+		{
+			cout << "Seed: " << seed << endl;
+		}
+		result.print();
+		cout << "Time: " << seconds << "s (" << result.games / seconds << " games/s)" << endl;
+		return 0;
+	}
+
+	if (greedy)
+	{
+		square_heatmap heatmap = posterior_heatmap(index, partial, workspace);
+		heatmap.print();
+
+		u32 best = heatmap.most_likely(partial.shot_locations);
+		cout << best % 8 << " " << best / 8 << endl;
+		return 0;
+	}
+
+	u32 move;
+	if (book_ptr && book_ptr->lookup(partial, move))
+	{
+		cout << move % 8 << " " << move / 8 << endl;
+		return 0;
+	}
+
+	cout << "Seed " << seed << endl;
+	auto pos = find_best_position(options, index, partial, rng, workspace);
+
+	cout << pos.first << " " << pos.second << endl;
+
+}
+#endif
+
+#ifdef SPLOOSHKABOOM_BENCH
+/* Kernel benchmarks, see bench.h. Built by make bench. */
+#include "bench.h"
+
+const u32 BENCH_DEPTH = 18;
+const u32 BENCH_GAMES = 16384;
+
+/* The full layout table and its index, built once for all benchmarks */
+const layout_index &bench_index()
+{
+	static const std::vector<squid_layout> all_layouts = generate_all_possible_squid_layouts();
+	static const layout_index index(all_layouts);
+	return index;
+}
+
+/* A few shots into a game: two misses and one hit */
+partial_solution bench_partial()
+{
+	partial_solution partial = {};
+	partial.shot_locations = (1ull << square_offset(3, 3)) | (1ull << square_offset(4, 4)) | (1ull << square_offset(4, 2));
+	partial.revealed_squids = 1ull << square_offset(4, 4);
+	return partial;
+}
+
+void bench_layout_matches_partial(bench::state &s)
+{
+	const auto &layouts = bench_index().layouts();
+	const partial_solution partial = bench_partial();
+
+	while (s.keep_running())
+	{
+		u32 matches = 0;
+		for (const auto &layout : layouts)
+		{
+			matches += layout_matches_partial(layout, partial) ? 1 : 0;
+		}
+		bench::do_not_optimize(matches);
+	}
+
+	s.set_items_per_iteration(layouts.size(), "layouts");
+}
+BENCHMARK(bench_layout_matches_partial);
+
+void bench_layout_index_filter(bench::state &s)
+{
+	const layout_index &index = bench_index();
+	const partial_solution partial = bench_partial();
+	std::vector<u64> bits(index.words());
+
+	while (s.keep_running())
+	{
+		index.filter(partial, bits.data());
+		bench::do_not_optimize(bits[0]);
+	}
+
+	s.set_items_per_iteration(index.size(), "layouts");
+}
+BENCHMARK(bench_layout_index_filter);
+
+void bench_layout_index_filter_shot(bench::state &s)
+{
+	const layout_index &index = bench_index();
+	const partial_solution partial = bench_partial();
+
+	std::vector<u64> start(index.words());
+	std::vector<u64> bits(index.words());
+	index.filter(partial, start.data());
+
+	while (s.keep_running())
+	{
+		bits = start;
+		index.filter_shot(partial, square_offset(4, 5), true, false, bits.data());
+		bench::do_not_optimize(bits[0]);
+	}
+
+	s.set_items_per_iteration(index.size(), "layouts");
+}
+BENCHMARK(bench_layout_index_filter_shot);
+
+void bench_compute_heatmap(bench::state &s)
+{
+	const layout_index &index = bench_index();
+	solver_workspace workspace;
+	layout_view layouts = filter_layouts(index, bench_partial(), workspace.layout_bits, workspace.layout_ids);
+
+	while (s.keep_running())
+	{
+		workspace.scratch.reset();
+
+		square_heatmap heatmap;
+		compute_heatmap(layouts, heatmap, workspace.scratch);
+		bench::do_not_optimize(heatmap.occupied[0]);
+	}
+
+	s.set_items_per_iteration(layouts.size(), "layouts");
+}
+BENCHMARK(bench_compute_heatmap);
+
+/* Server mode: a batch of eight shot patterns rated in one game state */
+void bench_rate_patterns(bench::state &s)
+{
+	const u32 BENCH_PATTERNS = 64;
+
+	const layout_index &index = bench_index();
+	solver_workspace workspace;
+	filter_layouts(index, bench_partial(), workspace.layout_bits, workspace.layout_ids);
+
+	std::mt19937 rng(s.seed());
+	std::vector<square_mask> patterns(BENCH_PATTERNS);
+	for (auto &pattern : patterns)
+	{
+		while (__builtin_popcountll(pattern) < 8)
+		{
+			pattern |= 1ull << randint(rng, 63);
+		}
+	}
+
+	std::vector<double> hit(BENCH_PATTERNS);
+	while (s.keep_running())
+	{
+		rate_patterns(index, workspace.layout_bits.data(), patterns.data(), BENCH_PATTERNS, hit.data());
+		bench::do_not_optimize(hit[0]);
+	}
+
+	s.set_items_per_iteration(BENCH_PATTERNS, "patterns");
+}
+BENCHMARK(bench_rate_patterns);
+
+void bench_gen_random_game(bench::state &s)
+{
+	const layout_index &index = bench_index();
+	const partial_solution partial = bench_partial();
+	std::mt19937 rng(s.seed());
+
+	solver_workspace workspace;
+	layout_view layouts = filter_layouts(index, partial, workspace.layout_bits, workspace.layout_ids);
+	game_set games = alloc_games(BENCH_DEPTH, BENCH_GAMES, workspace.scratch);
+
+	while (s.keep_running())
+	{
+		for (u32 i = 0; i < BENCH_GAMES; ++i)
+		{
+			gen_random_game(layouts, partial, games, i, rng);
+		}
+		bench::do_not_optimize(games.weights[0]);
+	}
+
+	s.set_items_per_iteration(BENCH_GAMES, "games");
+}
+BENCHMARK(bench_gen_random_game);
+
+void bench_alias_draw(bench::state &s)
+{
+	const layout_index &index = bench_index();
+	std::mt19937 rng(s.seed());
+
+	solver_workspace workspace;
+	layout_view layouts = filter_layouts(index, bench_partial(), workspace.layout_bits, workspace.layout_ids);
+
+	alias_table table;
+	table.build(layouts, workspace.scratch);
+
+	while (s.keep_running())
+	{
+		u32 sum = 0;
+		for (u32 i = 0; i < BENCH_GAMES; ++i)
+		{
+			sum += table.draw(rng);
+		}
+		bench::do_not_optimize(sum);
+	}
+
+	s.set_items_per_iteration(BENCH_GAMES, "draws");
+}
+BENCHMARK(bench_alias_draw);
+
+/* BENCH_GAMES sampled games of the given depth, sorted or not */
+game_set bench_games(u32 depth, bool sorted, u32 seed, solver_workspace &workspace)
+{
+	const partial_solution partial = bench_partial();
+	std::mt19937 rng(seed);
+
+	layout_view layouts = filter_layouts(bench_index(), partial, workspace.layout_bits, workspace.layout_ids);
+	game_set games = alloc_games(depth, BENCH_GAMES, workspace.scratch);
+	sample_games(layouts, partial, games, 0, BENCH_GAMES, rng);
+
+	return sorted ? sort_games(games, workspace.scratch) : games;
+}
+
+void bench_sort_games(bench::state &s)
+{
+	solver_workspace workspace;
+	game_set games = bench_games(BENCH_DEPTH, false, s.seed(), workspace);
+	arena scratch;
+
+	while (s.keep_running())
+	{
+		scratch.reset();
+		game_set sorted = sort_games(games, scratch);
+		bench::do_not_optimize(sorted.shots[0]);
+	}
+
+	s.set_items_per_iteration(BENCH_GAMES, "games");
+}
+BENCHMARK(bench_sort_games);
+
+/* calc_score over every opening of a sorted game set */
+template<u32 DEPTH>
+void bench_calc_score(bench::state &s)
+{
+	solver_workspace workspace;
+	game_set games = bench_games(DEPTH, true, s.seed(), workspace);
+	arena scratch;
+
+	while (s.keep_running())
+	{
+		scratch.reset();
+		shot_choice best = best_opening(games, scratch);
+		bench::do_not_optimize(best.score);
+	}
+
+	s.set_items_per_iteration(BENCH_GAMES, "games");
+}
+
+static bench::registration bench_calc_scores[] =
+{
+	{"calc_score_depth_8", bench_calc_score<8>},
+	{"calc_score_depth_18", bench_calc_score<18>},
+	{"calc_score_depth_40", bench_calc_score<40>},
+};
+
+int main(int argc, char **argv)
+{
+	return bench::main(argc, argv);
+}
+#endif
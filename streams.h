@@ -0,0 +1,123 @@
+#ifndef SPLOOSHKABOOM_STREAMS_H
+#define SPLOOSHKABOOM_STREAMS_H
+
+/*
+ * Reproducible random number streams for parallel code.
+ *
+ * A run has a single 64-bit seed (--seed, or a fresh one from the OS that
+ * the program prints). Every piece of random work draws from its own
+ * stream, named by a path of numbers below the seed such as {what, round,
+ * block}. generator() hashes the seed and path with SplitMix64 (Steele, Lea
+ * & Flood 2014) into a key and fills the whole state of an mt19937 from it,
+ * so streams are independent of each other and of the order they are
+ * created in. Work is split into blocks of a fixed size, never into one
+ * block per thread, so the same seed gives bit-identical results with any
+ * thread count and any scheduling.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <algorithm>
+#include <initializer_list>
+#include <random>
+
+#include "scheduler.h"
+
+namespace streams
+{
+	/* SplitMix64 output function */
+	constexpr uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	/* Key of the stream at path below seed */
+	inline uint64_t key(uint64_t seed, std::initializer_list<uint64_t> path)
+	{
+		uint64_t k = mix(seed + 0x9e3779b97f4a7c15ull);
+		for (uint64_t step : path)
+		{
+			k = mix(k ^ mix(step + 0x9e3779b97f4a7c15ull));
+		}
+		return k;
+	}
+
+	/* Seed sequence giving the SplitMix64 sequence of a key, for seeding
+	 * every word of a generator's state */
+	class splitmix_sequence
+	{
+		uint64_t state;
+
+	public:
+
+		typedef uint32_t result_type;
+
+		explicit splitmix_sequence(uint64_t k)
+			: state(k)
+		{
+		}
+
+		template<typename It>
+		void generate(It begin, It end)
+		{
+			for (It it = begin; it != end; ++it)
+			{
+				state += 0x9e3779b97f4a7c15ull;
+				*it = static_cast<uint32_t>(mix(state) >> 32);
+			}
+		}
+	};
+
+	inline std::mt19937 generator(uint64_t seed, std::initializer_list<uint64_t> path)
+	{
+		splitmix_sequence sequence(key(seed, path));
+		return std::mt19937(sequence);
+	}
+
+	/* A seed for a new stream, drawn from a generator; keeps code that is
+	 * handed an mt19937 reproducible when it splits into blocks */
+	inline uint64_t draw_seed(std::mt19937 &rng)
+	{
+		uint64_t high = rng();
+		return high << 32 | rng();
+	}
+
+	/* A seed nobody chose, for runs without --seed */
+	inline uint64_t random_seed()
+	{
+		std::random_device dev;
+		uint64_t high = dev();
+		return high << 32 | dev();
+	}
+
+	/* Parse a --seed argument; false unless it is a whole number */
+	inline bool parse_seed(const char *text, uint64_t &seed)
+	{
+		char *end;
+		seed = std::strtoull(text, &end, 0);
+		return *text != '\0' && *end == '\0';
+	}
+
+	/* Call body(begin, end, rng) over [0, n) in blocks of block items, in
+	 * parallel, each block drawing from stream {path..., block index} */
+	template<typename Body>
+	void parallel_blocks(uint64_t seed, std::initializer_list<uint64_t> path, size_t n, size_t block, const Body &body)
+	{
+		const uint64_t parent = key(seed, path);
+		const size_t n_blocks = (n + block - 1) / block;
+
+		scheduler::parallel_for(0, n_blocks, 1, [&] (size_t first, size_t last)
+		{
+			for (size_t b = first; b < last; ++b)
+			{
+				std::mt19937 rng = generator(parent, {b});
+				body(b * block, std::min(n, (b + 1) * block), rng);
+			}
+		});
+	}
+}
+
+#endif
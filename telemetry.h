@@ -0,0 +1,291 @@
+#ifndef SPLOOSHKABOOM_TELEMETRY_H
+#define SPLOOSHKABOOM_TELEMETRY_H
+
+/*
+ * Per round metrics of the GA programs, written as JSON lines or CSV.
+ *
+ * The GA thread only copies a record into a queue. A writer thread formats
+ * the queued records and writes them through a large stdio buffer, flushing
+ * once the queue is drained, so a slow terminal or disk never holds up a
+ * round.
+ */
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace telemetry
+{
+	enum class format
+	{
+		json,
+		csv,
+	};
+
+	/* Parse a --telemetry-format argument; false unless json or csv */
+	inline bool parse_format(const char *text, format &f)
+	{
+		if (std::strcmp(text, "json") == 0)
+		{
+			f = format::json;
+			return true;
+		}
+		if (std::strcmp(text, "csv") == 0)
+		{
+			f = format::csv;
+			return true;
+		}
+		return false;
+	}
+
+	struct round_record
+	{
+		uint32_t round = 0;
+
+		/* Mean goal value of the best, median and worst candidate */
+		double best = 0.0;
+		double median = 0.0;
+		double worst = 0.0;
+
+		/* Distinct candidates over the population size */
+		double diversity = 0.0;
+
+		uint64_t evaluations = 0;
+		double evaluations_per_second = 0.0;
+
+		/* Seconds since the start of the run */
+		double elapsed = 0.0;
+
+		/* Squares the best candidate shoots, as hex */
+		std::string best_mask;
+	};
+
+	/* Fitness spread and diversity of a population of (score, candidate)
+	 * pairs. mask(candidate) gives the squares a candidate shoots as a hex
+	 * string. */
+	template<typename Candidate, typename Mask>
+	round_record summarize(const std::vector<std::pair<double, Candidate> > &candidates, Mask mask)
+	{
+		round_record r;
+		if (candidates.empty())
+		{
+			return r;
+		}
+
+		std::vector<double> scores(candidates.size());
+		std::vector<Candidate> distinct;
+		distinct.reserve(candidates.size());
+		size_t best = 0;
+
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			scores[i] = candidates[i].first;
+			distinct.push_back(candidates[i].second);
+
+			if (candidates[i].first > candidates[best].first)
+			{
+				best = i;
+			}
+		}
+
+		auto middle = scores.begin() + scores.size() / 2;
+		std::nth_element(scores.begin(), middle, scores.end());
+		r.median = *middle;
+		r.best = candidates[best].first;
+		r.worst = *std::min_element(scores.begin(), scores.end());
+		r.best_mask = mask(candidates[best].second);
+
+		std::sort(distinct.begin(), distinct.end());
+		r.diversity = static_cast<double>(std::unique(distinct.begin(), distinct.end()) - distinct.begin()) / candidates.size();
+
+		return r;
+	}
+
+	class sink
+	{
+		FILE *file = nullptr;
+		bool owns_file = false;
+		format output = format::json;
+
+		std::vector<char> buffer;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		/* A record, or a preformatted line if text is not empty */
+		struct item
+		{
+			round_record record;
+			std::string text;
+		};
+
+		std::vector<item> pending;
+		bool stopping = false;
+		std::thread writer;
+
+		void write(const round_record &r)
+		{
+			if (output == format::json)
+			{
+				std::fprintf(file, "{\"round\":%" PRIu32 ",\"best\":%.6f,\"median\":%.6f,\"worst\":%.6f,\"diversity\":%.6f,"
+							 "\"evaluations\":%" PRIu64 ",\"evaluations_per_second\":%.0f,\"elapsed\":%.6f,\"best_mask\":\"%s\"}\n",
+							 r.round, r.best, r.median, r.worst, r.diversity, r.evaluations, r.evaluations_per_second, r.elapsed, r.best_mask.c_str());
+			}
+			else
+			{
+				std::fprintf(file, "%" PRIu32 ",%.6f,%.6f,%.6f,%.6f,%" PRIu64 ",%.0f,%.6f,%s\n",
+							 r.round, r.best, r.median, r.worst, r.diversity, r.evaluations, r.evaluations_per_second, r.elapsed, r.best_mask.c_str());
+			}
+		}
+
+		void run()
+		{
+			std::vector<item> batch;
+
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				wake.wait(lock, [this] { return stopping || !pending.empty(); });
+
+				if (pending.empty() && stopping)
+				{
+					break;
+				}
+
+				batch.swap(pending);
+				lock.unlock();
+
+				for (const auto &i : batch)
+				{
+					if (i.text.empty())
+					{
+						write(i.record);
+					}
+					else
+					{
+						std::fprintf(file, "%s\n", i.text.c_str());
+					}
+				}
+				batch.clear();
+
+				/* Make the records visible to tools following the file */
+				std::fflush(file);
+
+				lock.lock();
+			}
+		}
+
+	public:
+
+		~sink()
+		{
+			close();
+		}
+
+		/* Start writing to path ("-" for stdout). Returns false if the file
+		 * cannot be opened. */
+		bool open(const char *path, format f)
+		{
+			close();
+
+			owns_file = std::strcmp(path, "-") != 0;
+			file = owns_file ? std::fopen(path, "w") : stdout;
+			if (!file)
+			{
+				return false;
+			}
+
+			output = f;
+			if (owns_file)
+			{
+				buffer.resize(1 << 16);
+				std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+			}
+
+			if (output == format::csv)
+			{
+				std::fprintf(file, "round,best,median,worst,diversity,evaluations,evaluations_per_second,elapsed,best_mask\n");
+			}
+
+			stopping = false;
+			writer = std::thread([this] { run(); });
+			return true;
+		}
+
+		bool is_open() const
+		{
+			return file != nullptr;
+		}
+
+		void push(const round_record &r)
+		{
+			if (!file)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back({r, std::string()});
+			}
+			wake.notify_one();
+		}
+
+		/* Queue a line that is written as is, such as a JSON object that
+		 * is not a round record */
+		void push_line(std::string line)
+		{
+			if (!file)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back({round_record(), std::move(line)});
+			}
+			wake.notify_one();
+		}
+
+		format get_format() const
+		{
+			return output;
+		}
+
+		/* Write out every queued record and close the file */
+		void close()
+		{
+			if (!file)
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_one();
+			writer.join();
+
+			if (owns_file)
+			{
+				std::fclose(file);
+			}
+			else
+			{
+				std::fflush(file);
+			}
+			file = nullptr;
+		}
+	};
+}
+
+#endif